@@ -5,6 +5,7 @@
 #include <tinyev/Logger.h>
 #include <tinyev/EventLoop.h>
 #include <tinyev/TcpConnection.h>
+#include <tinyev/Payload.h>
 #include <tinyev/TcpServer.h>
 
 using namespace ev;
@@ -13,8 +14,11 @@ class ChargenServer
 {
 public:
     ChargenServer(EventLoop* loop, const InetAddress& addr)
-            : server_(loop, addr),
-              transfered_(0)
+            : loop_(loop),
+              server_(loop, addr),
+              transfered_(0),
+              lastCtlCalls_(0),
+              lastIteration_(0)
     {
         server_.setConnectionCallback(std::bind(
                 &ChargenServer::onConnection, this, _1));
@@ -26,9 +30,13 @@ public:
             line.push_back(char(i));
         line += line;
 
+        std::string message;
         for (size_t i = 0; i < 127-33; ++i)
-            message_ += line.substr(i, 72) + '\n';
-        transfered_ += message_.size();
+            message += line.substr(i, 72) + '\n';
+        // shared by all connections, never copied
+        message_ = Payload::make(std::move(message));
+        transfered_ += message_->size();
+        loop_->runEvery(5s, [this](){ printStatistics(); });
     }
 
     void start() { server_.start(); }
@@ -43,21 +51,35 @@ public:
             conn->send("[tinyev chargen server]\n");
             conn->send(message_);
         }
-        else {
+        else
             INFO("%ld bytes transfered", transfered_);
-        }
     }
 
     void onWriteComplete(const TcpConnectionPtr& conn)
     {
         conn->send(message_);
-        transfered_ += message_.size();
+        transfered_ += message_->size();
     }
 
 private:
+    void printStatistics()
+    {
+        uint64_t ctlCalls = loop_->ctlCalls() - lastCtlCalls_;
+        uint64_t iterations = loop_->iteration() - lastIteration_;
+        lastCtlCalls_ = loop_->ctlCalls();
+        lastIteration_ = loop_->iteration();
+        if (iterations > 0)
+            INFO("%.2f epoll_ctl() per loop iteration",
+                 static_cast<double>(ctlCalls) /
+                 static_cast<double>(iterations));
+    }
+
+    EventLoop* loop_;
     TcpServer server_;
     size_t transfered_;
-    std::string message_;
+    PayloadPtr message_;
+    uint64_t lastCtlCalls_;
+    uint64_t lastIteration_;
 };
 
 int main()
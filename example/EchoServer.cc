@@ -2,8 +2,6 @@
 // Created by frank on 17-9-1.
 //
 
-#include <map>
-
 #include <tinyev/Logger.h>
 #include <tinyev/EventLoop.h>
 #include <tinyev/TcpConnection.h>
@@ -18,20 +16,17 @@ public:
             : loop_(loop),
               server_(loop, addr),
               numThread_(numThread),
-              timeout_(timeout),
-              timer_(loop_->runEvery(timeout_, [this](){onTimeout();}))
+              timeout_(timeout)
     {
         server_.setConnectionCallback(std::bind(
                 &EchoServer::onConnection, this, _1));
         server_.setMessageCallback(std::bind(
                 &EchoServer::onMessage, this, _1, _2));
-        server_.setWriteCompleteCallback(std::bind(
-                &EchoServer::onWriteComplete, this, _1));
+        server_.setIdleTimeout(timeout_);
+        // stop reading a client that does not read its echo
+        server_.setFlowControl(1024, 256);
     }
 
-    ~EchoServer()
-    { loop_->cancelTimer(timer_); }
-
     void start()
     {
         // set thread num here
@@ -49,9 +44,10 @@ public:
             conn->setHighWaterMarkCallback(
                     std::bind(&EchoServer::onHighWaterMark, this, _1, _2),
                     1024);
-            expireAfter(conn, timeout_);
+            conn->setLowWaterMarkCallback(
+                    std::bind(&EchoServer::onLowWaterMark, this, _1, _2),
+                    256);
         }
-        else connections_.erase(conn);
     }
 
     void onMessage(const TcpConnectionPtr& conn, Buffer& buffer)
@@ -62,41 +58,18 @@ public:
 
         // send will retrieve the buffer
         conn->send(buffer);
-        expireAfter(conn, timeout_);
     }
 
     void onHighWaterMark(const TcpConnectionPtr& conn, size_t mark)
     {
-        INFO("high water mark %lu bytes, stop read", mark);
-        conn->stopRead();
-        expireAfter(conn, 2 * timeout_);
+        INFO("connection %s high water mark %lu bytes, stop read",
+             conn->name().c_str(), mark);
     }
 
-    void onWriteComplete(const TcpConnectionPtr& conn)
+    void onLowWaterMark(const TcpConnectionPtr& conn, size_t mark)
     {
-        if (!conn->isReading()) {
-            INFO("write complete, start read");
-            conn->startRead();
-            expireAfter(conn, timeout_);
-        }
-    }
-
-private:
-    void expireAfter(const TcpConnectionPtr& conn, Nanosecond interval)
-    {
-        connections_[conn] = clock::nowAfter(interval);
-    }
-
-    void onTimeout()
-    {
-        for (auto it = connections_.begin(); it != connections_.end(); ) {
-            if (it->second <= clock::now()) {
-                INFO("connection timeout force close");
-                it->first->forceClose();
-                it = connections_.erase(it);
-            }
-            else it++;
-        }
+        INFO("connection %s low water mark %lu bytes, start read",
+             conn->name().c_str(), mark);
     }
 
 private:
@@ -104,9 +77,6 @@ private:
     TcpServer server_;
     const size_t numThread_;
     const Nanosecond timeout_;
-    Timer* timer_;
-    typedef std::map<TcpConnectionPtr, Timestamp> ConnectionList;
-    ConnectionList connections_;
 };
 
 int main()
@@ -0,0 +1,116 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <tinyev/Logger.h>
+#include <tinyev/EventLoop.h>
+#include <tinyev/TcpConnection.h>
+#include <tinyev/TcpServer.h>
+
+using namespace ev;
+
+// send a whole file to every connection then shut it down.
+// "sendfile" queues the file as one region by TcpConnection::sendFile(),
+// "read" reads 64KB at a time and sends it when the last one is written.
+// the throughput of each connection is logged when it is done.
+
+class FileServer
+{
+public:
+    FileServer(EventLoop* loop, const InetAddress& addr,
+               const char* path, bool useSendfile)
+            : server_(loop, addr),
+              useSendfile_(useSendfile),
+              fd_(::open(path, O_RDONLY | O_CLOEXEC)),
+              fileSize_(0)
+    {
+        if (fd_ == -1)
+            SYSFATAL("open %s", path);
+        struct stat st;
+        if (::fstat(fd_, &st) == -1)
+            SYSFATAL("fstat %s", path);
+        fileSize_ = static_cast<size_t>(st.st_size);
+
+        server_.setConnectionCallback(std::bind(
+                &FileServer::onConnection, this, _1));
+        server_.setWriteCompleteCallback(std::bind(
+                &FileServer::onWriteComplete, this, _1));
+        INFO("serving %s (%lu bytes) by %s",
+             path, fileSize_, useSendfile_ ? "sendfile" : "read+send");
+    }
+
+    ~FileServer()
+    { ::close(fd_); }
+
+    void start() { server_.start(); }
+
+    void onConnection(const TcpConnectionPtr& conn)
+    {
+        if (conn->connected()) {
+            conn->setContext(Transfer{0, clock::now()});
+            if (useSendfile_) {
+                conn->sendFile(fd_, 0, fileSize_);
+                conn->shutdown();
+            }
+            else sendChunk(conn);
+        }
+        else {
+            auto& transfer = std::any_cast<const Transfer&>(conn->getContext());
+            Nanosecond ns = clock::now() - transfer.start;
+            double seconds = static_cast<double>(ns.count()) / 1e9;
+            INFO("connection %s done in %.3f s, %.1f MB/s",
+                 conn->name().c_str(), seconds,
+                 static_cast<double>(fileSize_) / seconds / 1e6);
+        }
+    }
+
+    void onWriteComplete(const TcpConnectionPtr& conn)
+    {
+        if (!useSendfile_ && conn->connected())
+            sendChunk(conn);
+    }
+
+private:
+    struct Transfer
+    {
+        off_t offset;
+        Timestamp start;
+    };
+
+    void sendChunk(const TcpConnectionPtr& conn)
+    {
+        auto& transfer = std::any_cast<Transfer&>(conn->getContext());
+        char buf[65536];
+        ssize_t n = ::pread(fd_, buf, sizeof(buf), transfer.offset);
+        if (n < 0)
+            SYSERR("FileServer::pread()");
+        if (n <= 0) {
+            conn->shutdown();
+            return;
+        }
+        transfer.offset += n;
+        conn->send(buf, static_cast<size_t>(n));
+    }
+
+private:
+    TcpServer server_;
+    const bool useSendfile_;
+    const int fd_;
+    size_t fileSize_;
+};
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        printf("usage: ./file_server <file> [sendfile|read] [port]\n");
+        exit(EXIT_FAILURE);
+    }
+    bool useSendfile = argc < 3 || strcmp(argv[2], "read") != 0;
+    uint16_t port = argc > 3 ? static_cast<uint16_t>(atoi(argv[3])) : 9877;
+
+    setLogLevel(LOG_LEVEL_INFO);
+    EventLoop loop;
+    FileServer server(&loop, InetAddress(port), argv[1], useSendfile);
+    server.start();
+    loop.loop();
+}
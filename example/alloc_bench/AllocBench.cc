@@ -0,0 +1,132 @@
+#include <atomic>
+#include <thread>
+#include <cstdlib>
+
+#include <tinyev/Logger.h>
+#include <tinyev/EventLoop.h>
+#include <tinyev/EventLoopThread.h>
+#include <tinyev/CountDownLatch.h>
+#include <tinyev/TcpConnection.h>
+#include <tinyev/TcpServer.h>
+#include <tinyev/TcpClient.h>
+#include <tinyev/Payload.h>
+
+using namespace ev;
+
+// count heap allocations per message sent to a connection from a thread
+// other than its loop thread. the connection belongs to a client loop
+// thread, the main thread sends #count messages of 64 bytes in each way
+// and the peer discards them.
+
+namespace
+{
+
+std::atomic<uint64_t> g_allocations(0);
+
+}
+
+void* operator new(size_t size)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = malloc(size == 0 ? 1 : size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{ free(p); }
+
+void operator delete(void* p, size_t) noexcept
+{ free(p); }
+
+namespace
+{
+
+const std::string kMessage(64, 'x');
+
+void runServer(uint16_t port, EventLoop** serverLoop, CountDownLatch* latch)
+{
+    EventLoop loop;
+    TcpServer server(&loop, InetAddress(port));
+    server.setConnectionCallback([](const TcpConnectionPtr&){});
+    server.setMessageCallback([](const TcpConnectionPtr&, Buffer& buffer) {
+        buffer.retrieveAll();
+    });
+    server.start();
+    *serverLoop = &loop;
+    latch->count();
+    loop.loop();
+}
+
+template <typename Send>
+void bench(const char* name, EventLoop* loop, size_t count, Send&& send)
+{
+    // let the last round drain
+    std::this_thread::sleep_for(100ms);
+    uint64_t start = g_allocations.load();
+    for (size_t i = 0; i < count; ++i)
+        send();
+    CountDownLatch done(1);
+    loop->queueInLoop([&](){ done.count(); });
+    done.wait();
+    uint64_t allocations = g_allocations.load() - start;
+    INFO("%-28s %.2f allocations per send", name,
+         static_cast<double>(allocations) / static_cast<double>(count));
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    size_t count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100000;
+    if (count == 0) {
+        printf("usage: ./alloc_bench [#count]\n");
+        exit(EXIT_FAILURE);
+    }
+    const uint16_t port = 9882;
+
+    EventLoop* serverLoop = nullptr;
+    CountDownLatch serverLatch(1);
+    std::thread server(runServer, port, &serverLoop, &serverLatch);
+    serverLatch.wait();
+
+    EventLoopThread clientThread;
+    EventLoop* loop = clientThread.startLoop();
+    TcpConnectionPtr conn;
+    CountDownLatch connected(1);
+    std::unique_ptr<TcpClient> client;
+    loop->runInLoop([&](){
+        client = std::make_unique<TcpClient>(loop, InetAddress("127.0.0.1", port));
+        client->setConnectionCallback([&](const TcpConnectionPtr& c) {
+            if (c->connected()) {
+                conn = c;
+                connected.count();
+            }
+        });
+        client->start();
+    });
+    connected.wait();
+
+    bench("send(string_view)", loop, count, [&](){
+        conn->send(kMessage);
+    });
+    auto payload = Payload::make(kMessage);
+    bench("send(PayloadPtr)", loop, count, [&](){
+        conn->send(payload);
+    });
+    bench("queueInLoop(conn, string)", loop, count, [&](){
+        loop->queueInLoop([conn, message = kMessage]() {
+            conn->send(message);
+        });
+    });
+
+    CountDownLatch closed(1);
+    loop->runInLoop([&](){
+        conn.reset();
+        client.reset();
+        closed.count();
+    });
+    closed.wait();
+    serverLoop->quit();
+    server.join();
+}
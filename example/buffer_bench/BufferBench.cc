@@ -0,0 +1,127 @@
+#include <algorithm>
+#include <cstring>
+
+#include <tinyev/Logger.h>
+#include <tinyev/Buffer.h>
+#include <tinyev/Timestamp.h>
+
+using namespace ev;
+
+// delimiter searches of Buffer compared with the std::search/memchr
+// versions they replaced:
+//   pipelined: many short CRLF lines arrive in one read
+//   partial:   one big CRLF frame arrives in small pieces, the codec
+//              searches after every piece
+//   eol:       long '\n' terminated lines
+//   any of:    stop at the first of " \r\n:"
+
+namespace
+{
+
+const char kCRLF[] = "\r\n";
+const char kAnyOf[] = " \r\n:";
+
+const char* oldFindCRLF(const Buffer& buffer)
+{
+    const char* crlf = std::search(buffer.peek(), buffer.beginWrite(), kCRLF, kCRLF + 2);
+    return crlf == buffer.beginWrite() ? nullptr : crlf;
+}
+
+const char* oldFindEOL(const Buffer& buffer)
+{
+    const void* eol = memchr(buffer.peek(), '\n', buffer.readableBytes());
+    return static_cast<const char*>(eol);
+}
+
+const char* oldFindAnyOf(const Buffer& buffer)
+{
+    const char* p = std::find_first_of(buffer.peek(), buffer.beginWrite(),
+                                       kAnyOf, kAnyOf + sizeof(kAnyOf) - 1);
+    return p == buffer.beginWrite() ? nullptr : p;
+}
+
+const char* newFindCRLF(const Buffer& buffer)
+{ return buffer.findCRLF(); }
+
+const char* newFindEOL(const Buffer& buffer)
+{ return buffer.findEOL(); }
+
+const char* newFindAnyOf(const Buffer& buffer)
+{ return buffer.findAnyOf(kAnyOf); }
+
+typedef const char* (*FindFunc)(const Buffer&);
+
+std::string makeLines(size_t lineLen, size_t count, const char* eol)
+{
+    std::string line(lineLen - strlen(eol), 'x');
+    line += eol;
+    std::string data;
+    for (size_t i = 0; i < count; ++i)
+        data += line;
+    return data;
+}
+
+// consume all delimited lines, return ns per byte
+double consume(const std::string& data, size_t eolLen, size_t rounds, FindFunc find)
+{
+    Buffer buffer(data.size());
+    size_t lines = 0;
+    Timestamp start = clock::now();
+    for (size_t r = 0; r < rounds; ++r) {
+        buffer.append(data);
+        while (const char* eol = find(buffer)) {
+            buffer.retrieveUntil(eol + eolLen);
+            lines++;
+        }
+        buffer.retrieveAll();
+    }
+    Nanosecond ns = clock::now() - start;
+    if (lines == 0)
+        FATAL("no line found");
+    return static_cast<double>(ns.count()) /
+           static_cast<double>(data.size() * rounds);
+}
+
+// one frame arriving in pieces, return ns per frame
+double partial(size_t frameLen, size_t pieceLen, size_t rounds, FindFunc find)
+{
+    std::string frame = makeLines(frameLen, 1, kCRLF);
+    Buffer buffer(frameLen);
+    Timestamp start = clock::now();
+    for (size_t r = 0; r < rounds; ++r) {
+        const char* crlf = nullptr;
+        for (size_t i = 0; i < frame.size() && crlf == nullptr; i += pieceLen) {
+            buffer.append(frame.data() + i, std::min(pieceLen, frame.size() - i));
+            crlf = find(buffer);
+        }
+        if (crlf == nullptr)
+            FATAL("frame not found");
+        buffer.retrieveAll();
+    }
+    Nanosecond ns = clock::now() - start;
+    return static_cast<double>(ns.count()) / static_cast<double>(rounds);
+}
+
+}
+
+int main()
+{
+    std::string pipelined = makeLines(64, 1024, kCRLF);
+    INFO("pipelined 64B lines: std::search %.3f ns/B, findCRLF() %.3f ns/B",
+         consume(pipelined, 2, 1000, oldFindCRLF),
+         consume(pipelined, 2, 1000, newFindCRLF));
+
+    INFO("partial 64KB frame in 512B pieces: std::search %.0f ns, findCRLF() %.0f ns",
+         partial(65536, 512, 200, oldFindCRLF),
+         partial(65536, 512, 200, newFindCRLF));
+
+    std::string lines = makeLines(4096, 16, "\n");
+    INFO("4KB lines: memchr %.3f ns/B, findEOL() %.3f ns/B",
+         consume(lines, 1, 1000, oldFindEOL),
+         consume(lines, 1, 1000, newFindEOL));
+
+    std::string fields = makeLines(256, 256, ":");
+    INFO("256B fields: std::find_first_of %.3f ns/B, findAnyOf() %.3f ns/B",
+         consume(fields, 1, 1000, oldFindAnyOf),
+         consume(fields, 1, 1000, newFindAnyOf));
+}
@@ -0,0 +1,146 @@
+#include <thread>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include <tinyev/Logger.h>
+#include <tinyev/EventLoop.h>
+#include <tinyev/CountDownLatch.h>
+#include <tinyev/TcpConnection.h>
+#include <tinyev/TcpServer.h>
+
+using namespace ev;
+
+// short-lived connections: client threads connect, wait for the one
+// byte greeting of the server and close, over and over. the client
+// ends in TIME_WAIT, which loopback connects reuse (tcp_tw_reuse = 2).
+// reports connections per second and what each one costs the server
+// loop thread: CPU time, heap allocations and page faults.
+
+namespace
+{
+
+thread_local uint64_t t_allocations = 0;
+
+}
+
+void* operator new(size_t size)
+{
+    t_allocations++;
+    if (void* p = malloc(size == 0 ? 1 : size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{ free(p); }
+
+void operator delete(void* p, size_t) noexcept
+{ free(p); }
+
+namespace
+{
+
+const uint16_t kPort = 9883;
+
+struct ServerStats
+{
+    uint64_t connections = 0;
+    uint64_t allocations = 0;
+    Nanosecond cpuTime{0};
+    long pageFaults = 0;
+};
+
+struct rusage threadUsage()
+{
+    struct rusage usage;
+    ::getrusage(RUSAGE_THREAD, &usage);
+    return usage;
+}
+
+Nanosecond cpuTimeOf(const struct rusage& usage)
+{
+    auto toNs = [](const struct timeval& tv) {
+        return Second(tv.tv_sec) + Microsecond(tv.tv_usec);
+    };
+    return toNs(usage.ru_utime) + toNs(usage.ru_stime);
+}
+
+void runServer(EventLoop** serverLoop, CountDownLatch* latch, ServerStats* stats)
+{
+    EventLoop loop;
+    TcpServer server(&loop, InetAddress(kPort));
+    server.setConnectionCallback([=](const TcpConnectionPtr& conn) {
+        if (conn->connected()) {
+            stats->connections++;
+            conn->send("x", 1);
+        }
+    });
+    server.start();
+    *serverLoop = &loop;
+    latch->count();
+
+    struct rusage start = threadUsage();
+    uint64_t allocations = t_allocations;
+    loop.loop();
+    struct rusage end = threadUsage();
+    stats->allocations = t_allocations - allocations;
+    stats->cpuTime = cpuTimeOf(end) - cpuTimeOf(start);
+    stats->pageFaults = end.ru_minflt - start.ru_minflt;
+}
+
+void runClient(const std::atomic_bool* stop)
+{
+    InetAddress server("127.0.0.1", kPort);
+    while (!stop->load(std::memory_order_relaxed)) {
+        int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd == -1)
+            SYSFATAL("socket()");
+        if (::connect(fd, server.getSockaddr(), server.getSocklen()) == -1)
+            SYSFATAL("connect()");
+        char greeting;
+        if (::read(fd, &greeting, 1) != 1)
+            SYSFATAL("read()");
+        ::close(fd);
+    }
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    size_t threads = argc > 1 ? strtoul(argv[1], nullptr, 10) : 2;
+    Second duration(argc > 2 ? strtol(argv[2], nullptr, 10) : 5);
+    if (threads == 0 || duration <= 0s) {
+        printf("usage: ./churn_bench [#client threads] [#seconds]\n");
+        exit(EXIT_FAILURE);
+    }
+
+    EventLoop* serverLoop = nullptr;
+    ServerStats stats;
+    CountDownLatch latch(1);
+    std::thread server(runServer, &serverLoop, &latch, &stats);
+    latch.wait();
+
+    std::atomic_bool stop(false);
+    std::vector<std::thread> clients;
+    for (size_t i = 0; i < threads; ++i)
+        clients.emplace_back(runClient, &stop);
+    std::this_thread::sleep_for(duration);
+    stop = true;
+    for (auto& client: clients)
+        client.join();
+    serverLoop->quit();
+    server.join();
+
+    double seconds = std::chrono::duration<double>(duration).count();
+    auto perConnection = [&](double value) {
+        return value / static_cast<double>(stats.connections);
+    };
+    INFO("%.0f connections/s, server loop per connection: %.2f us CPU, "
+         "%.2f allocations, %.3f page faults",
+         static_cast<double>(stats.connections) / seconds,
+         perConnection(static_cast<double>(stats.cpuTime.count()) / 1000),
+         perConnection(static_cast<double>(stats.allocations)),
+         perConnection(static_cast<double>(stats.pageFaults)));
+}
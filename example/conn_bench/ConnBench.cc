@@ -0,0 +1,112 @@
+#include <csignal>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include <tinyev/Logger.h>
+#include <tinyev/EventLoop.h>
+#include <tinyev/Channel.h>
+#include <tinyev/TcpConnection.h>
+#include <tinyev/TcpServer.h>
+
+using namespace ev;
+
+// memory of idle connections. a child process opens #connections to
+// the server over loopback and leaves them idle, the server reports the
+// growth of its RSS per connection once all of them are accepted.
+// each destination address 127.0.0.x gives the client another range of
+// ephemeral ports, 1M connections need 2M file descriptors (ulimit -Hn).
+
+namespace
+{
+
+const uint16_t kPort = 9882;
+const size_t kConnectionsPerAddress = 20000;
+
+size_t residentBytes()
+{
+    FILE* fp = fopen("/proc/self/statm", "r");
+    if (fp == nullptr)
+        SYSFATAL("fopen /proc/self/statm");
+    unsigned long pages = 0, resident = 0;
+    if (fscanf(fp, "%lu %lu", &pages, &resident) != 2)
+        FATAL("bad /proc/self/statm");
+    fclose(fp);
+    return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+[[noreturn]] void runClients(size_t connections)
+{
+    for (size_t i = 0; i < connections; ++i) {
+        int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd == -1)
+            SYSFATAL("socket() #%lu", i);
+        std::string ip = "127.0.0." + std::to_string(1 + i / kConnectionsPerAddress);
+        InetAddress peer(ip, kPort);
+        if (::connect(fd, peer.getSockaddr(), peer.getSocklen()) == -1)
+            SYSFATAL("connect() #%lu to %s", i, ip.c_str());
+    }
+    // idle until killed
+    while (true)
+        ::pause();
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    size_t connections = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000;
+    bool shared = argc > 2 && strcmp(argv[2], "shared") == 0;
+    if (connections == 0 || connections / kConnectionsPerAddress >= 254) {
+        printf("usage: ./conn_bench [#connections] [shared]\n");
+        exit(EXIT_FAILURE);
+    }
+
+    struct rlimit limit;
+    ::getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    ::setrlimit(RLIMIT_NOFILE, &limit);
+    if (limit.rlim_cur < connections + 64)
+        FATAL("%lu connections need more than %lu fds per process, raise ulimit -Hn",
+              connections, limit.rlim_cur);
+
+    setLogLevel(LOG_LEVEL_INFO);
+    EventLoop loop;
+    TcpServer server(&loop, InetAddress(kPort));
+    size_t accepted = 0;
+    server.setSharedReceiveBuffer(shared);
+    server.setConnectionCallback([&](const TcpConnectionPtr& conn) {
+        if (conn->connected())
+            accepted++;
+    });
+    server.start();
+
+    size_t before = residentBytes();
+    pid_t child = ::fork();
+    if (child == -1)
+        SYSFATAL("fork()");
+    if (child == 0)
+        runClients(connections);
+
+    Timestamp start = clock::now();
+    loop.runEvery(100ms, [&]() {
+        int status;
+        if (::waitpid(child, &status, WNOHANG) == child)
+            FATAL("clients exited after %lu connections", accepted);
+        if (accepted < connections)
+            return;
+        double seconds = std::chrono::duration<double>(clock::now() - start).count();
+        size_t after = residentBytes();
+        INFO("%lu idle connections accepted in %.1f s", connections, seconds);
+        INFO("sizeof(TcpConnection) %lu, sizeof(Channel) %lu, %s receive buffer",
+             sizeof(TcpConnection), sizeof(Channel), shared ? "shared" : "own");
+        INFO("RSS %.1f MiB -> %.1f MiB, %.0f bytes per connection",
+             static_cast<double>(before) / 1024 / 1024,
+             static_cast<double>(after) / 1024 / 1024,
+             static_cast<double>(after - before) / static_cast<double>(connections));
+        ::kill(child, SIGKILL);
+        ::waitpid(child, nullptr, 0);
+        loop.quit();
+    });
+    loop.loop();
+}
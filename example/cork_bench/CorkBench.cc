@@ -0,0 +1,116 @@
+#include <thread>
+#include <fstream>
+
+#include <tinyev/Logger.h>
+#include <tinyev/EventLoop.h>
+#include <tinyev/CountDownLatch.h>
+#include <tinyev/TcpConnection.h>
+#include <tinyev/TcpServer.h>
+#include <tinyev/TcpClient.h>
+
+using namespace ev;
+
+// small request/response: every request line is answered with a header,
+// a body and a trailer in three send() calls. the server runs once with
+// immediate writes and once with deferred flush, the client keeps one
+// request in flight per session.
+
+namespace
+{
+
+const char kRequest[] = "GET /0123456789\r\n";
+const std::string kHeader = "HTTP/1.1 200 OK\r\nContent-Length: 64\r\n\r\n";
+const std::string kBody(64, 'x');
+const std::string kTrailer = "\r\n";
+const size_t kResponseSize = kHeader.size() + kBody.size() + kTrailer.size();
+
+// write syscalls made by the calling thread
+uint64_t threadWriteCalls()
+{
+    std::ifstream io("/proc/thread-self/io");
+    std::string key;
+    uint64_t value;
+    while (io >> key >> value)
+        if (key == "syscw:")
+            return value;
+    return 0;
+}
+
+void runServer(uint16_t port, bool deferred,
+               EventLoop** serverLoop, CountDownLatch* latch, uint64_t* writes)
+{
+    EventLoop loop;
+    TcpServer server(&loop, InetAddress(port));
+    server.setDeferredFlush(deferred);
+    server.setConnectionCallback([](const TcpConnectionPtr&){});
+    server.setMessageCallback([](const TcpConnectionPtr& conn, Buffer& buffer) {
+        while (const char* crlf = buffer.findCRLF()) {
+            buffer.retrieveUntil(crlf + 2);
+            conn->send(kHeader);
+            conn->send(kBody);
+            conn->send(kTrailer);
+        }
+    });
+    server.start();
+    *serverLoop = &loop;
+    latch->count();
+
+    uint64_t start = threadWriteCalls();
+    loop.loop();
+    *writes = threadWriteCalls() - start;
+}
+
+void bench(uint16_t port, bool deferred, size_t sessions, Nanosecond duration)
+{
+    EventLoop* serverLoop = nullptr;
+    CountDownLatch latch(1);
+    uint64_t serverWrites = 0;
+    std::thread thread(runServer, port, deferred, &serverLoop, &latch, &serverWrites);
+    latch.wait();
+
+    EventLoop loop;
+    uint64_t responses = 0;
+    std::vector<std::unique_ptr<TcpClient>> clients;
+    for (size_t i = 0; i < sessions; ++i) {
+        auto client = new TcpClient(&loop, InetAddress("127.0.0.1", port));
+        client->setConnectionCallback([](const TcpConnectionPtr& conn) {
+            if (conn->connected())
+                conn->send(kRequest);
+        });
+        client->setMessageCallback([&](const TcpConnectionPtr& conn, Buffer& buffer) {
+            while (buffer.readableBytes() >= kResponseSize) {
+                buffer.retrieve(kResponseSize);
+                responses++;
+                conn->send(kRequest);
+            }
+        });
+        client->start();
+        clients.emplace_back(client);
+    }
+    loop.runAfter(duration, [&](){ loop.quit(); });
+    loop.loop();
+
+    serverLoop->quit();
+    thread.join();
+
+    double seconds = std::chrono::duration<double>(duration).count();
+    INFO("%-9s %.0f responses/s, %.2f server write() per response",
+         deferred ? "deferred" : "immediate",
+         static_cast<double>(responses) / seconds,
+         static_cast<double>(serverWrites) / static_cast<double>(responses));
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    size_t sessions = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100;
+    Second duration(argc > 2 ? strtol(argv[2], nullptr, 10) : 5);
+    if (sessions == 0 || duration <= 0s) {
+        printf("usage: ./cork_bench [#sessions] [#seconds]\n");
+        exit(EXIT_FAILURE);
+    }
+
+    bench(9878, false, sessions, duration);
+    bench(9879, true, sessions, duration);
+}
@@ -0,0 +1,166 @@
+#include <thread>
+#include <algorithm>
+
+#include <tinyev/Logger.h>
+#include <tinyev/EventLoop.h>
+#include <tinyev/CountDownLatch.h>
+#include <tinyev/TcpConnection.h>
+#include <tinyev/TcpServer.h>
+#include <tinyev/TcpClient.h>
+
+using namespace ev;
+
+// small requests sharing one server loop with bulk uploaders.
+// the server hashes every byte it reads, so the work of one read grows
+// with its size, and echoes the lines starting with '?'. the bulk
+// clients upload 1KB lines as fast as the server takes them, the small
+// clients keep one "?ping" in flight each and record its round trip.
+// the server runs once without a read budget and once with one.
+
+namespace
+{
+
+const char kPing[] = "?ping\n";
+
+struct ServerStats
+{
+    uint64_t bytes = 0;
+    uint64_t budgetHits = 0;
+    uint64_t hash = 0;
+};
+
+void runServer(uint16_t port, size_t budget, EventLoop** serverLoop,
+               CountDownLatch* latch, ServerStats* stats)
+{
+    EventLoop loop;
+    TcpServer server(&loop, InetAddress(port));
+    std::vector<TcpConnectionPtr> connections;
+    server.setReadBudget(budget);
+    server.setConnectionCallback([&](const TcpConnectionPtr& conn) {
+        if (conn->connected())
+            connections.push_back(conn);
+    });
+    server.setMessageCallback([=](const TcpConnectionPtr& conn, Buffer& buffer) {
+        stats->bytes += buffer.readableBytes();
+        while (const char* eol = buffer.findEOL()) {
+            for (const char* p = buffer.peek(); p != eol; ++p)
+                stats->hash = stats->hash * 31 + static_cast<unsigned char>(*p);
+            if (*buffer.peek() == '?')
+                conn->send(buffer.peek(), static_cast<size_t>(eol - buffer.peek() + 1));
+            buffer.retrieveUntil(eol + 1);
+        }
+    });
+    server.start();
+    *serverLoop = &loop;
+    latch->count();
+
+    loop.loop();
+    for (auto& conn: connections)
+        stats->budgetHits += conn->readBudgetHits();
+}
+
+void runBulk(uint16_t port, size_t sessions, EventLoop** bulkLoop, CountDownLatch* latch)
+{
+    std::string line(1023, 'x');
+    line += '\n';
+    std::string chunk;
+    while (chunk.size() < 256 * 1024)
+        chunk += line;
+
+    EventLoop loop;
+    std::vector<std::unique_ptr<TcpClient>> clients;
+    for (size_t i = 0; i < sessions; ++i) {
+        auto client = new TcpClient(&loop, InetAddress("127.0.0.1", port));
+        client->setConnectionCallback([&](const TcpConnectionPtr& conn) {
+            if (conn->connected())
+                conn->send(chunk);
+        });
+        client->setWriteCompleteCallback([&](const TcpConnectionPtr& conn) {
+            if (conn->connected())
+                conn->send(chunk);
+        });
+        client->start();
+        clients.emplace_back(client);
+    }
+    *bulkLoop = &loop;
+    latch->count();
+    loop.loop();
+}
+
+void bench(uint16_t port, size_t budget, size_t bulkSessions,
+           size_t sessions, Nanosecond duration)
+{
+    EventLoop* serverLoop = nullptr;
+    EventLoop* bulkLoop = nullptr;
+    ServerStats stats;
+    // the bulk clients would only retry in 3s if they beat the listen()
+    CountDownLatch serverLatch(1);
+    std::thread server(runServer, port, budget, &serverLoop, &serverLatch, &stats);
+    serverLatch.wait();
+    CountDownLatch bulkLatch(1);
+    std::thread bulk(runBulk, port, bulkSessions, &bulkLoop, &bulkLatch);
+    bulkLatch.wait();
+
+    EventLoop loop;
+    std::vector<Nanosecond> latencies;
+    std::vector<std::unique_ptr<TcpClient>> clients;
+    for (size_t i = 0; i < sessions; ++i) {
+        auto client = new TcpClient(&loop, InetAddress("127.0.0.1", port));
+        client->setConnectionCallback([](const TcpConnectionPtr& conn) {
+            if (conn->connected()) {
+                conn->setContext(clock::now());
+                conn->send(kPing);
+            }
+        });
+        client->setMessageCallback([&](const TcpConnectionPtr& conn, Buffer& buffer) {
+            while (const char* eol = buffer.findEOL()) {
+                buffer.retrieveUntil(eol + 1);
+                Timestamp now = clock::now();
+                latencies.push_back(now - std::any_cast<Timestamp>(conn->getContext()));
+                conn->setContext(now);
+                conn->send(kPing);
+            }
+        });
+        client->start();
+        clients.emplace_back(client);
+    }
+    loop.runAfter(duration, [&](){ loop.quit(); });
+    loop.loop();
+
+    bulkLoop->quit();
+    bulk.join();
+    serverLoop->quit();
+    server.join();
+
+    if (latencies.empty())
+        FATAL("no small request answered");
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) {
+        auto i = static_cast<size_t>(p * static_cast<double>(latencies.size() - 1));
+        return static_cast<double>(latencies[i].count()) / 1000;
+    };
+    double seconds = std::chrono::duration<double>(duration).count();
+    INFO("budget %6lu: small p50 %.0f us, p99 %.0f us, p999 %.0f us, "
+         "%.0f requests/s, %.0f MiB/s read, %lu budget hits",
+         budget, percentile(0.5), percentile(0.99), percentile(0.999),
+         static_cast<double>(latencies.size()) / seconds,
+         static_cast<double>(stats.bytes) / seconds / 1024 / 1024,
+         stats.budgetHits);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    size_t budget = argc > 1 ? strtoul(argv[1], nullptr, 10) : 16384;
+    size_t bulkSessions = argc > 2 ? strtoul(argv[2], nullptr, 10) : 4;
+    size_t sessions = argc > 3 ? strtoul(argv[3], nullptr, 10) : 10;
+    Second duration(argc > 4 ? strtol(argv[4], nullptr, 10) : 5);
+    if (budget == 0 || sessions == 0 || duration <= 0s) {
+        printf("usage: ./fair_bench [budget] [#bulk sessions] [#sessions] [#seconds]\n");
+        exit(EXIT_FAILURE);
+    }
+
+    bench(9880, 0, bulkSessions, sessions, duration);
+    bench(9881, budget, bulkSessions, sessions, duration);
+}
@@ -10,7 +10,8 @@
 #include <tinyev/EventLoop.h>
 #include <tinyev/TcpServer.h>
 #include <tinyev/TcpConnection.h>
-#include <tinyev/EventLoopThread.h>
+#include <tinyev/EventLoopThreadPool.h>
+#include <tinyev/CountDownLatch.h>
 
 #include "Codec.h"
 
@@ -21,6 +22,7 @@ class KthServer: noncopyable
 public:
 	KthServer(EventLoop* loop, const InetAddress& addr, int64_t count, int nThreads)
 			: ioLoop_(loop),
+			  pool_(static_cast<size_t>(std::max(nThreads, 0))),
 			  nThreads_(nThreads),
 			  server_(loop, addr),
 			  sum_(0),
@@ -93,12 +95,7 @@ private:
 
 	void startWorkerThreads()
 	{
-		for (int i = 0; i < nThreads_; ++i) {
-			auto thread = new EventLoopThread();
-			auto loop = thread->startLoop();
-			threads_.emplace_back(thread);
-			loops_.push_back(loop);
-		}
+		pool_.start();
 
 		INFO("%d threads started", nThreads_);
 	}
@@ -146,9 +143,10 @@ private:
 	{
 		CountDownLatch latch(nThreads_);
 		for (int i = 0; i < nThreads_; ++i) {
-			loops_[i]->assertNotInLoopThread();
-			loops_[i]->queueInLoop([&latch, &func, i, this](){
-				loops_[i]->assertInLoopThread();
+			EventLoop* loop = pool_.getLoop(static_cast<size_t>(i));
+			loop->assertNotInLoopThread();
+			loop->queueInLoop([&latch, &func, i, loop, this](){
+				loop->assertInLoopThread();
 				func(numbers_[i]);
 				latch.count();
 			});
@@ -156,15 +154,11 @@ private:
 		latch.wait();
 	}
 
-	typedef std::vector<EventLoop*> WokerLoops;
-	typedef std::unique_ptr<EventLoopThread> ThreadPtr;
-	typedef std::vector<ThreadPtr> ThreadPtrList;
 	typedef std::vector<std::vector<int64_t>> Numbers;
 
 	EventLoop* ioLoop_;
 
-	WokerLoops loops_;
-	ThreadPtrList threads_;
+	EventLoopThreadPool pool_;
 	Numbers numbers_;
 	const int nThreads_;
 
@@ -0,0 +1,199 @@
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <sys/resource.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include <tinyev/Logger.h>
+#include <tinyev/EventLoop.h>
+#include <tinyev/TcpConnection.h>
+#include <tinyev/TcpClient.h>
+
+using namespace ev;
+
+namespace
+{
+
+// user + system CPU time of this process
+Nanosecond cpuTime()
+{
+    struct rusage usage;
+    ::getrusage(RUSAGE_SELF, &usage);
+    auto toNs = [](const struct timeval& tv) {
+        return Second(tv.tv_sec) + Microsecond(tv.tv_usec);
+    };
+    return toNs(usage.ru_utime) + toNs(usage.ru_stime);
+}
+
+// time stamp counter, it ticks at the nominal CPU frequency.
+// zero where there is none
+uint64_t cycleCounter()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// CPU time in cycles, the counter rate is measured over the same wall time
+double cpuCycles(Nanosecond cpu, uint64_t counterTicks, Nanosecond wall)
+{
+    return std::chrono::duration<double>(cpu).count() *
+           static_cast<double>(counterTicks) /
+           std::chrono::duration<double>(wall).count();
+}
+
+// read and write family syscalls of this process, io_uring
+// requests are not counted
+uint64_t readWriteSyscalls()
+{
+    FILE* fp = ::fopen("/proc/self/io", "r");
+    if (fp == nullptr)
+        return 0;
+    uint64_t total = 0;
+    char line[64];
+    unsigned long long value;
+    while (::fgets(line, sizeof(line), fp) != nullptr) {
+        if (::sscanf(line, "syscr: %llu", &value) == 1 ||
+            ::sscanf(line, "syscw: %llu", &value) == 1)
+            total += value;
+    }
+    ::fclose(fp);
+    return total;
+}
+
+// syscalls of the poller and of the connections
+uint64_t syscalls(EventLoop* loop)
+{
+    return loop->pollerSyscalls() + readWriteSyscalls();
+}
+
+}
+
+class PingpongClient: noncopyable
+{
+public:
+    PingpongClient(EventLoop* loop, const InetAddress& addr,
+                   size_t sessions, size_t blockSize)
+            : loop_(loop),
+              message_(blockSize, 'x'),
+              messages_(0),
+              bytes_(0),
+              startSyscalls_(0),
+              startCycles_(0)
+    {
+        for (size_t i = 0; i < sessions; ++i) {
+            auto client = new TcpClient(loop, addr);
+            client->setConnectionCallback(std::bind(
+                    &PingpongClient::onConnection, this, _1));
+            client->setMessageCallback(std::bind(
+                    &PingpongClient::onMessage, this, _1, _2));
+            clients_.emplace_back(client);
+        }
+    }
+
+    void start()
+    {
+        startCpu_ = cpuTime();
+        startCycles_ = cycleCounter();
+        startTime_ = clock::now();
+        for (auto& client: clients_)
+            client->start();
+    }
+
+    void stop(Nanosecond duration)
+    {
+        uint64_t calls = syscalls(loop_) - startSyscalls_;
+        double seconds = std::chrono::duration<double>(duration).count();
+        Nanosecond cpu = cpuTime() - startCpu_;
+        double cycles = cpuCycles(cpu, cycleCounter() - startCycles_,
+                                  clock::now() - startTime_);
+        INFO("%lu messages, %.2f MiB/s, %.0f messages/s, %.3f syscalls per message, %.0f client cycles per message",
+             messages_, static_cast<double>(bytes_) / seconds / 1024 / 1024,
+             static_cast<double>(messages_) / seconds,
+             static_cast<double>(calls) / static_cast<double>(messages_),
+             cycles / static_cast<double>(messages_));
+        // a round trip per message when a block fits in one read
+        if (!latencies_.empty()) {
+            std::sort(latencies_.begin(), latencies_.end());
+            auto percentile = [this](double p) {
+                auto i = static_cast<size_t>(p * static_cast<double>(latencies_.size() - 1));
+                return static_cast<double>(latencies_[i].count()) / 1000;
+            };
+            INFO("round trip p50 %.1f us, p99 %.1f us, client CPU %.0f%%",
+                 percentile(0.5), percentile(0.99),
+                 100 * std::chrono::duration<double>(cpu).count() / seconds);
+        }
+        loop_->quit();
+    }
+
+private:
+    void onConnection(const TcpConnectionPtr& conn)
+    {
+        if (conn->connected()) {
+            startSyscalls_ = syscalls(loop_);
+            conn->setContext(clock::now());
+            conn->send(message_);
+        }
+    }
+
+    void onMessage(const TcpConnectionPtr& conn, Buffer& buffer)
+    {
+        messages_++;
+        bytes_ += buffer.readableBytes();
+        Timestamp now = clock::now();
+        auto& last = std::any_cast<Timestamp&>(conn->getContext());
+        latencies_.push_back(now - last);
+        last = now;
+        conn->send(buffer);
+    }
+
+    typedef std::unique_ptr<TcpClient> TcpClientPtr;
+
+    EventLoop* loop_;
+    std::vector<TcpClientPtr> clients_;
+    std::string message_;
+    uint64_t messages_;
+    uint64_t bytes_;
+    uint64_t startSyscalls_;
+    Nanosecond startCpu_;
+    uint64_t startCycles_;
+    Timestamp startTime_;
+    std::vector<Nanosecond> latencies_;
+};
+
+void usage()
+{
+    printf("usage: ./pingpong_client epoll|io_uring #sessions #blockSize #seconds [#busyPollUs]\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 5)
+        usage();
+
+    PollerType type = kEPollPoller;
+    if (strcmp(argv[1], "io_uring") == 0)
+        type = kIoUringPoller;
+    else if (strcmp(argv[1], "epoll") != 0)
+        usage();
+
+    size_t sessions = strtoul(argv[2], nullptr, 10);
+    size_t blockSize = strtoul(argv[3], nullptr, 10);
+    Second duration(strtol(argv[4], nullptr, 10));
+    if (sessions == 0 || blockSize == 0 || duration <= 0s)
+        usage();
+
+    EventLoop loop(type);
+    if (argc > 5)
+        loop.setBusyPoll(Microsecond(strtol(argv[5], nullptr, 10)));
+    InetAddress addr("127.0.0.1", 9877);
+    PingpongClient client(&loop, addr, sessions, blockSize);
+    client.start();
+    loop.runAfter(duration, [&](){ client.stop(duration); });
+    loop.loop();
+}
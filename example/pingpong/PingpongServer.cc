@@ -0,0 +1,165 @@
+#include <cstdio>
+#include <cstring>
+#include <sys/resource.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include <tinyev/Logger.h>
+#include <tinyev/EventLoop.h>
+#include <tinyev/TcpConnection.h>
+#include <tinyev/TcpServer.h>
+
+using namespace ev;
+
+namespace
+{
+
+// user + system CPU time of this process
+Nanosecond cpuTime()
+{
+    struct rusage usage;
+    ::getrusage(RUSAGE_SELF, &usage);
+    auto toNs = [](const struct timeval& tv) {
+        return Second(tv.tv_sec) + Microsecond(tv.tv_usec);
+    };
+    return toNs(usage.ru_utime) + toNs(usage.ru_stime);
+}
+
+// time stamp counter, it ticks at the nominal CPU frequency.
+// zero where there is none
+uint64_t cycleCounter()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// CPU time in cycles, the counter rate is measured over the same wall time
+double cpuCycles(Nanosecond cpu, uint64_t counterTicks, Nanosecond wall)
+{
+    return std::chrono::duration<double>(cpu).count() *
+           static_cast<double>(counterTicks) /
+           std::chrono::duration<double>(wall).count();
+}
+
+// read and write family syscalls of this process, io_uring
+// requests are not counted
+uint64_t readWriteSyscalls()
+{
+    FILE* fp = ::fopen("/proc/self/io", "r");
+    if (fp == nullptr)
+        return 0;
+    uint64_t total = 0;
+    char line[64];
+    unsigned long long value;
+    while (::fgets(line, sizeof(line), fp) != nullptr) {
+        if (::sscanf(line, "syscr: %llu", &value) == 1 ||
+            ::sscanf(line, "syscw: %llu", &value) == 1)
+            total += value;
+    }
+    ::fclose(fp);
+    return total;
+}
+
+// syscalls of the poller and of the connections
+uint64_t syscalls(EventLoop* loop)
+{
+    return loop->pollerSyscalls() + readWriteSyscalls();
+}
+
+}
+
+class PingpongServer: noncopyable
+{
+public:
+    PingpongServer(EventLoop* loop, const InetAddress& addr, bool edgeTriggered)
+            : loop_(loop),
+              server_(loop, addr),
+              messages_(0),
+              bytes_(0),
+              lastSyscalls_(syscalls(loop)),
+              lastCpu_(cpuTime()),
+              lastCycles_(cycleCounter()),
+              lastTime_(clock::now())
+    {
+        server_.setMessageCallback(std::bind(
+                &PingpongServer::onMessage, this, _1, _2));
+        server_.setEdgeTriggered(edgeTriggered);
+        loop_->runEvery(5s, [this](){ printStatistics(); });
+    }
+
+    void start() { server_.start(); }
+
+private:
+    void onMessage(const TcpConnectionPtr& conn, Buffer& buffer)
+    {
+        messages_++;
+        bytes_ += buffer.readableBytes();
+        conn->send(buffer);
+    }
+
+    void printStatistics()
+    {
+        uint64_t calls = syscalls(loop_) - lastSyscalls_;
+        lastSyscalls_ += calls;
+        Nanosecond cpu = cpuTime() - lastCpu_;
+        lastCpu_ += cpu;
+        uint64_t cycles = cycleCounter() - lastCycles_;
+        lastCycles_ += cycles;
+        Nanosecond wall = clock::now() - lastTime_;
+        lastTime_ += wall;
+        if (messages_ > 0) {
+            double mib = static_cast<double>(bytes_) / 1024 / 1024;
+            double seconds = std::chrono::duration<double>(wall).count();
+            INFO("%lu messages, %.2f MiB/s, %.3f syscalls per message, %.1f syscalls per MiB, CPU %.0f%%, %.0f cycles per message",
+                 messages_, mib / seconds,
+                 static_cast<double>(calls) / static_cast<double>(messages_),
+                 static_cast<double>(calls) / mib,
+                 100 * std::chrono::duration<double>(cpu).count() / seconds,
+                 cpuCycles(cpu, cycles, wall) / static_cast<double>(messages_));
+        }
+        messages_ = 0;
+        bytes_ = 0;
+    }
+
+    EventLoop* loop_;
+    TcpServer server_;
+    uint64_t messages_;
+    uint64_t bytes_;
+    uint64_t lastSyscalls_;
+    Nanosecond lastCpu_;
+    uint64_t lastCycles_;
+    Timestamp lastTime_;
+};
+
+void usage()
+{
+    printf("usage: ./pingpong_server epoll|epoll-et|io_uring [#busyPollUs]\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+        usage();
+
+    PollerType type = kEPollPoller;
+    bool edgeTriggered = false;
+    if (strcmp(argv[1], "io_uring") == 0)
+        type = kIoUringPoller;
+    else if (strcmp(argv[1], "epoll-et") == 0)
+        edgeTriggered = true;
+    else if (strcmp(argv[1], "epoll") != 0)
+        usage();
+
+    EventLoop loop(type);
+    if (argc > 2)
+        loop.setBusyPoll(Microsecond(strtol(argv[2], nullptr, 10)));
+    InetAddress addr(9877);
+    PingpongServer server(&loop, addr, edgeTriggered);
+    server.start();
+    loop.loop();
+}
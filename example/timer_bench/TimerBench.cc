@@ -0,0 +1,188 @@
+#include <set>
+#include <random>
+#include <thread>
+#include <sys/resource.h>
+
+#include <tinyev/Logger.h>
+#include <tinyev/EventLoop.h>
+
+using namespace ev;
+
+// add #count timers expiring in [1s, 2s), then #count times cancel
+// a random pending timer and add a new one (e.g. connection timeout
+// refreshed by a new request), and finally let them all expire.
+// the timing wheel of TimerQueue is compared with the std::set it replaced.
+// then count how many timers per second are created and canceled at
+// once (a request timeout of a request answered right away), and how
+// many pending timers per second are moved by EventLoop::resetTimer().
+
+namespace
+{
+
+double cpuSeconds()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+           static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+double nsPerOp(Timestamp start, size_t count)
+{
+    Nanosecond ns = clock::now() - start;
+    return static_cast<double>(ns.count()) / static_cast<double>(count);
+}
+
+// the old TimerQueue without timerfd
+class SetTimerQueue: noncopyable
+{
+public:
+    ~SetTimerQueue()
+    {
+        for (auto& e: timers_)
+            delete e.second;
+    }
+
+    Timer* addTimer(TimerCallback cb, Timestamp when)
+    {
+        auto timer = new Timer(std::move(cb), when, Nanosecond::zero());
+        timers_.insert({when, timer});
+        return timer;
+    }
+
+    void cancelTimer(Timer* timer)
+    {
+        timers_.erase({timer->when(), timer});
+        delete timer;
+    }
+
+    bool empty() const
+    { return timers_.empty(); }
+
+    Timestamp earliest() const
+    { return timers_.begin()->first; }
+
+    void expire(Timestamp now)
+    {
+        auto end = timers_.lower_bound({now + 1ns, nullptr});
+        std::vector<Entry> entries(timers_.begin(), end);
+        timers_.erase(timers_.begin(), end);
+        for (auto& e: entries) {
+            e.second->run();
+            delete e.second;
+        }
+    }
+
+private:
+    typedef std::pair<Timestamp, Timer*> Entry;
+    std::set<Entry> timers_;
+};
+
+Nanosecond randomDelay(std::mt19937& rng)
+{
+    return 1s + Microsecond(rng() % 1000000);
+}
+
+void benchTimingWheel(size_t count)
+{
+    EventLoop loop;
+    std::mt19937 rng(0);
+    std::vector<TimerId> timers(count);
+    size_t fired = 0;
+    auto callback = [&](){
+        if (++fired == count)
+            loop.quit();
+    };
+
+    Timestamp start = clock::now();
+    for (auto& timer: timers)
+        timer = loop.runAfter(randomDelay(rng), callback);
+    double add = nsPerOp(start, count);
+
+    start = clock::now();
+    for (size_t i = 0; i < count; ++i) {
+        TimerId& timer = timers[rng() % count];
+        loop.cancelTimer(timer);
+        timer = loop.runAfter(randomDelay(rng), callback);
+    }
+    double churn = nsPerOp(start, count);
+
+    double cpu = cpuSeconds();
+    loop.loop();
+    cpu = cpuSeconds() - cpu;
+
+    INFO("timing wheel: add %.0f ns, cancel+add %.0f ns, expire %.0f ns (cpu)",
+         add, churn, cpu * 1e9 / static_cast<double>(count));
+}
+
+void benchStdSet(size_t count)
+{
+    SetTimerQueue queue;
+    std::mt19937 rng(0);
+    std::vector<Timer*> timers(count);
+    auto callback = [](){};
+
+    Timestamp start = clock::now();
+    for (auto& timer: timers)
+        timer = queue.addTimer(callback, clock::nowAfter(randomDelay(rng)));
+    double add = nsPerOp(start, count);
+
+    start = clock::now();
+    for (size_t i = 0; i < count; ++i) {
+        Timer*& timer = timers[rng() % count];
+        queue.cancelTimer(timer);
+        timer = queue.addTimer(callback, clock::nowAfter(randomDelay(rng)));
+    }
+    double churn = nsPerOp(start, count);
+
+    // a timerfd wakes up in 1ms resolution
+    double cpu = cpuSeconds();
+    while (!queue.empty()) {
+        std::this_thread::sleep_until(std::max(queue.earliest(), clock::nowAfter(1ms)));
+        queue.expire(clock::now());
+    }
+    cpu = cpuSeconds() - cpu;
+
+    INFO("std::set:     add %.0f ns, cancel+add %.0f ns, expire %.0f ns (cpu)",
+         add, churn, cpu * 1e9 / static_cast<double>(count));
+}
+
+void benchChurn(size_t count)
+{
+    EventLoop loop;
+    std::mt19937 rng(0);
+    auto callback = [](){};
+
+    Timestamp start = clock::now();
+    for (size_t i = 0; i < count; ++i)
+        loop.cancelTimer(loop.runAfter(randomDelay(rng), callback));
+    double createCancel = 1e3 / nsPerOp(start, count);
+
+    std::vector<TimerId> timers(1000);
+    for (auto& timer: timers)
+        timer = loop.runAfter(randomDelay(rng), callback);
+    start = clock::now();
+    for (size_t i = 0; i < count; ++i)
+        loop.resetTimer(timers[i % timers.size()], clock::nowAfter(randomDelay(rng)));
+    double reset = 1e3 / nsPerOp(start, count);
+
+    INFO("timing wheel: create+cancel %.1f M/s, reset %.1f M/s", createCancel, reset);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    size_t count = 1000000;
+    if (argc > 1)
+        count = strtoul(argv[1], nullptr, 10);
+    if (count == 0) {
+        printf("usage: ./timer_bench [#count]\n");
+        exit(EXIT_FAILURE);
+    }
+
+    INFO("%lu timers", count);
+    benchStdSet(count);
+    benchTimingWheel(count);
+    benchChurn(count);
+}
@@ -0,0 +1,64 @@
+#include <algorithm>
+
+#include <tinyev/Logger.h>
+#include <tinyev/EventLoop.h>
+
+using namespace ev;
+
+// fire a one shot timer #count times in a row, each added by the
+// callback of the last one, and record how late it runs. the loop
+// runs with a 1ms tick and a timerfd (the default), then with a 1us
+// tick and a timerfd, then with a 1us tick driven by poll() timeout.
+
+namespace
+{
+
+void bench(const char* mode, Nanosecond tick, bool pollTimers,
+           Nanosecond interval, size_t count)
+{
+    EventLoop loop;
+    loop.setTimerTick(tick);
+    loop.setPollTimers(pollTimers);
+
+    std::vector<Nanosecond> lateness;
+    lateness.reserve(count);
+    Timestamp when;
+    std::function<void()> fire = [&]() {
+        lateness.push_back(clock::now() - when);
+        if (lateness.size() == count) {
+            loop.quit();
+            return;
+        }
+        when = clock::nowAfter(interval);
+        loop.runAt(when, fire);
+    };
+    when = clock::nowAfter(interval);
+    loop.runAt(when, fire);
+    loop.loop();
+
+    std::sort(lateness.begin(), lateness.end());
+    auto percentile = [&](double p) {
+        auto i = static_cast<size_t>(p * static_cast<double>(lateness.size() - 1));
+        return static_cast<double>(lateness[i].count()) / 1000;
+    };
+    INFO("%-14s %5ld us: late p50 %7.1f us, p99 %7.1f us, max %7.1f us",
+         mode, std::chrono::duration_cast<Microsecond>(interval).count(),
+         percentile(0.5), percentile(0.99), percentile(1));
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    size_t count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000;
+    if (count == 0) {
+        printf("usage: ./timer_jitter [#count]\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (Nanosecond interval: {Nanosecond(50us), Nanosecond(200us), Nanosecond(1ms)}) {
+        bench("timerfd, 1ms", 1ms, false, interval, count);
+        bench("timerfd, 1us", 1us, false, interval, count);
+        bench("poll(), 1us", 1us, true, interval, count);
+    }
+}
@@ -3,6 +3,7 @@
 //
 
 #include <unistd.h>
+#include <fcntl.h>
 #include <cassert>
 
 #include <tinyev/EventLoop.h>
@@ -23,15 +24,27 @@ int createSocket()
     return ret;
 }
 
+int openIdleFd()
+{
+    int ret = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (ret == -1)
+        SYSERR("Acceptor::open() /dev/null");
+    return ret;
+}
+
 }
 
 Acceptor::Acceptor(EventLoop* loop, const InetAddress& local)
         : listening_(false),
           loop_(loop),
           acceptFd_(createSocket()),
-          acceptChannel_(loop, acceptFd_),
-          local_(local)
+          idleFd_(openIdleFd()),
+          acceptChannel_(loop, acceptFd_, this),
+          local_(local),
+          peerAddr_()
 {
+    if (loop->completionIo())
+        acceptChannel_.setIoMode(Channel::kAcceptIo);
     int on = 1;
     int ret = ::setsockopt(acceptFd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
     if (ret == -1)
@@ -51,42 +64,99 @@ void Acceptor::listen()
     if (ret == -1)
         SYSFATAL("Acceptor::listen()");
 
-    acceptChannel_.setReadCallback([this](){handleRead();});
     acceptChannel_.enableRead();
 }
 
 
 Acceptor::~Acceptor()
 {
+    // an accept in flight writes into peerAddr_
+    if (acceptChannel_.polling)
+        acceptChannel_.disableAll();
     ::close(acceptFd_);
+    if (idleFd_ != -1)
+        ::close(idleFd_);
 }
 
 void Acceptor::handleRead()
 {
     loop_->assertInLoopThread();
 
-    struct sockaddr_in addr;
-    socklen_t len = sizeof(addr);
-
-    void* any = &addr;
-    int sockfd = ::accept4(acceptFd_, static_cast<sockaddr*>(any),
-                           &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
-    if (sockfd == -1) {
-        int savedErrno = errno;
-        SYSERR("Acceptor::accept4()");
-        switch (savedErrno) {
-            case ECONNABORTED:
-            case EMFILE:
-                break;
-            default:
-                FATAL("unexpected accept4() error");
+    // level-triggered: one connection per report,
+    // edge-triggered: until the accept queue is empty
+    do {
+        struct sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+
+        void* any = &addr;
+        int sockfd = ::accept4(acceptFd_, static_cast<sockaddr*>(any),
+                               &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (sockfd == -1) {
+            if (errno == EAGAIN || !handleAcceptError(errno))
+                return;
+            continue;
         }
+        newConnection(sockfd, addr);
+    } while (acceptChannel_.isEdgeTriggered());
+}
+
+struct iovec Acceptor::readBuffer()
+{
+    return {&peerAddr_, sizeof(peerAddr_)};
+}
+
+void Acceptor::handleReadDone(int result)
+{
+    loop_->assertInLoopThread();
+    // the poller submits the next accept after this
+    if (result >= 0)
+        newConnection(result, peerAddr_);
+    else
+        handleAcceptError(-result);
+}
+
+// false if the accept queue should be left alone for now
+bool Acceptor::handleAcceptError(int err)
+{
+    errno = err;
+    SYSERR("Acceptor::accept4()");
+    switch (err) {
+        case ECONNABORTED:
+            return true;
+        case EMFILE:
+        case ENFILE:
+            // the connection stays queued and, edge-triggered,
+            // is never reported again. make room to take it off
+            return dropConnection();
+        default:
+            FATAL("unexpected accept4() error");
+            return false;
     }
+}
 
+void Acceptor::newConnection(int sockfd, const struct sockaddr_in& addr)
+{
     if (newConnectionCallback_) {
         InetAddress peer;
         peer.setAddress(addr);
         newConnectionCallback_(sockfd, local_, peer);
     }
     else ::close(sockfd);
-}
\ No newline at end of file
+}
+
+// accept and close one queued connection with the spare fd,
+// false if there is none or the queue is empty
+bool Acceptor::dropConnection()
+{
+    if (idleFd_ == -1) {
+        // lost it to an earlier shortage, wait for fds to be freed
+        idleFd_ = openIdleFd();
+        return false;
+    }
+    ::close(idleFd_);
+    int sockfd = ::accept4(acceptFd_, nullptr, nullptr, SOCK_CLOEXEC);
+    if (sockfd != -1)
+        ::close(sockfd);
+    idleFd_ = openIdleFd();
+    return sockfd != -1;
+}
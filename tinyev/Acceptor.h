@@ -16,7 +16,7 @@ namespace ev
 
 class EventLoop;
 
-class Acceptor:noncopyable
+class Acceptor: noncopyable, private ChannelHandler
 {
 public:
     Acceptor(EventLoop* loop, const InetAddress& local);
@@ -29,15 +29,25 @@ public:
 
     void setNewConnectionCallback(const NewConnectionCallback& cb)
     { newConnectionCallback_ = cb; }
+    // drain the accept queue on every readiness report
+    void setEdgeTriggered(bool on)
+    { acceptChannel_.setEdgeTriggered(on); }
 
 private:
-    void handleRead();
+    void handleRead() override;
+    struct iovec readBuffer() override;
+    void handleReadDone(int result) override;
+    bool handleAcceptError(int err);
+    bool dropConnection();
+    void newConnection(int sockfd, const struct sockaddr_in& addr);
 
     bool listening_;
     EventLoop* loop_;
     const int acceptFd_;
+    int idleFd_;          // spare fd given up to accept on EMFILE
     Channel acceptChannel_;
     InetAddress local_;
+    struct sockaddr_in peerAddr_; // filled by the poller in completion IO
     NewConnectionCallback newConnectionCallback_;
 };
 
@@ -22,18 +22,18 @@ const char Buffer::kCRLF[] = "\r\n";
 const size_t Buffer::kCheapPrepend;
 const size_t Buffer::kInitialSize;
 
-ssize_t Buffer::readFd(int fd, int* savedErrno)
+ssize_t Buffer::readFd(int fd, int* savedErrno, size_t maxBytes)
 {
     char extrabuf[65536];
     struct iovec vec[2];
-    const size_t writable = writableBytes();
+    const size_t writable = std::min(writableBytes(), maxBytes);
     vec[0].iov_base = begin() + writerIndex_;
     vec[0].iov_len = writable;
     vec[1].iov_base = extrabuf;
-    vec[1].iov_len = sizeof extrabuf;
+    vec[1].iov_len = std::min(sizeof extrabuf, maxBytes - writable);
     // when there is enough space in this buffer, don't read into extrabuf.
     // when extrabuf is used, we read 128k-1 bytes at most.
-    const int iovcnt = (writable < sizeof extrabuf) ? 2 : 1;
+    const int iovcnt = (writable < sizeof extrabuf && vec[1].iov_len > 0) ? 2 : 1;
     const ssize_t n = ::readv(fd, vec, iovcnt);
 
     if (n < 0)
@@ -47,3 +47,78 @@ ssize_t Buffer::readFd(int fd, int* savedErrno)
     return n;
 }
 
+
+const char* Buffer::findDelimiter(std::string_view delim) const
+{
+    uint64_t key = scanKey(kScanDelimiter, delim);
+    const char* found = scanDelimiter(resumeScan(key), beginWrite(),
+                                      delim.data(), delim.size());
+    // a delimiter may straddle the end of readable bytes
+    saveScan(key, found, delim.empty() ? 0 : delim.size() - 1);
+    return found;
+}
+
+const char* Buffer::findAnyOf(std::string_view set) const
+{
+    uint64_t key = scanKey(kScanAnyOf, set);
+    const char* found = scanAnyOf(resumeScan(key), beginWrite(),
+                                  set.data(), set.size());
+    saveScan(key, found, 0);
+    return found;
+}
+
+uint64_t Buffer::scanKey(ScanKind kind, std::string_view bytes)
+{
+    // kind, length and content, 0 if too long to be remembered
+    if (bytes.empty() || bytes.size() > 7)
+        return 0;
+    uint64_t key = 0;
+    memcpy(&key, bytes.data(), bytes.size());
+    return key | uint64_t(bytes.size()) << 56 | uint64_t(kind) << 60;
+}
+
+const char* Buffer::resumeScan(uint64_t key) const
+{
+    if (key != 0 && key == scanKey_ && scanIndex_ > readerIndex_)
+        return begin() + scanIndex_;
+    return peek();
+}
+
+void Buffer::saveScan(uint64_t key, const char* found, size_t overlap) const
+{
+    scanKey_ = key;
+    if (found != nullptr)
+        scanIndex_ = static_cast<size_t>(found - begin());
+    else
+        scanIndex_ = std::max(readerIndex_, writerIndex_ - std::min(overlap, readableBytes()));
+}
+
+const size_t BufferPool::kMaxPooledCapacity;
+
+BufferPool::BufferPool(size_t maxFreeBuffers)
+        : maxFree_(maxFreeBuffers)
+{
+}
+
+void BufferPool::get(Buffer& buffer)
+{
+    assert(buffer.readableBytes() == 0);
+    if (free_.empty())
+        Buffer().swap(buffer);
+    else {
+        free_.back().swap(buffer);
+        free_.pop_back();
+    }
+}
+
+void BufferPool::put(Buffer& buffer)
+{
+    assert(buffer.readableBytes() == 0);
+    Buffer empty(0);
+    empty.swap(buffer);
+    if (free_.size() < maxFree_ && empty.internalCapacity() > 0 &&
+        empty.internalCapacity() <= kMaxPooledCapacity) {
+        empty.retrieveAll();
+        free_.push_back(std::move(empty));
+    }
+}
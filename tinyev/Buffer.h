@@ -22,6 +22,10 @@
 #include <string>
 #include <cassert>
 #include <cstring>
+#include <cstdint>
+
+#include <tinyev/noncopyable.h>
+#include <tinyev/ByteScan.h>
 
 namespace ev
 {
@@ -32,14 +36,16 @@ public:
     static const size_t kCheapPrepend = 8;
     static const size_t kInitialSize = 1024;
 
+    // initialSize == 0 allocates nothing until the first append
     explicit Buffer(size_t initialSize = kInitialSize)
-            : buffer_(kCheapPrepend + initialSize),
-              readerIndex_(kCheapPrepend),
-              writerIndex_(kCheapPrepend)
+            : buffer_(initialSize == 0 ? 0 : kCheapPrepend + initialSize),
+              readerIndex_(initialSize == 0 ? 0 : kCheapPrepend),
+              writerIndex_(readerIndex_),
+              scanIndex_(0),
+              scanKey_(0)
     {
         assert(readableBytes() == 0);
         assert(writableBytes() == initialSize);
-        assert(prependableBytes() == kCheapPrepend);
     }
 
     void swap(Buffer &rhs)
@@ -47,6 +53,8 @@ public:
         buffer_.swap(rhs.buffer_);
         std::swap(readerIndex_, rhs.readerIndex_);
         std::swap(writerIndex_, rhs.writerIndex_);
+        std::swap(scanIndex_, rhs.scanIndex_);
+        std::swap(scanKey_, rhs.scanKey_);
     }
 
     size_t readableBytes() const
@@ -58,37 +66,40 @@ public:
     size_t prependableBytes() const
     { return readerIndex_; }
 
+    size_t internalCapacity() const
+    { return buffer_.capacity(); }
+
     const char *peek() const
     { return begin() + readerIndex_; }
 
+    // find*() without a start resume from where the last search for
+    // the same delimiter (up to 7 bytes) stopped, so a partial frame
+    // is not rescanned every time more bytes arrive
     const char *findCRLF() const
-    {
-        const char *crlf = std::search(peek(), beginWrite(), kCRLF, kCRLF + 2);
-        return crlf == beginWrite() ? nullptr : crlf;
-    }
+    { return findDelimiter(std::string_view(kCRLF, 2)); }
 
     const char *findCRLF(const char *start) const
     {
         assert(peek() <= start);
         assert(start <= beginWrite());
-        const char *crlf = std::search(start, beginWrite(), kCRLF, kCRLF + 2);
-        return crlf == beginWrite() ? nullptr : crlf;
+        return scanCRLF(start, beginWrite());
     }
 
     const char *findEOL() const
-    {
-        const void *eol = memchr(peek(), '\n', readableBytes());
-        return static_cast<const char *>(eol);
-    }
+    { return findDelimiter(std::string_view("\n", 1)); }
 
     const char *findEOL(const char *start) const
     {
         assert(peek() <= start);
         assert(start <= beginWrite());
-        const void *eol = memchr(start, '\n', beginWrite() - start);
-        return static_cast<const char *>(eol);
+        return scanDelimiter(start, beginWrite(), "\n", 1);
     }
 
+    const char *findDelimiter(std::string_view delim) const;
+
+    // first byte that is one of set
+    const char *findAnyOf(std::string_view set) const;
+
     void retrieve(size_t len)
     {
         assert(len <= readableBytes());
@@ -119,8 +130,9 @@ public:
 
     void retrieveAll()
     {
-        readerIndex_ = kCheapPrepend;
-        writerIndex_ = kCheapPrepend;
+        readerIndex_ = buffer_.empty() ? 0 : kCheapPrepend;
+        writerIndex_ = readerIndex_;
+        scanIndex_ = 0;
     }
 
     std::string retrieveAllAsString()
@@ -279,26 +291,40 @@ public:
     {
         assert(len <= prependableBytes());
         readerIndex_ -= len;
+        scanIndex_ = 0;
         auto d = static_cast<const char *>(data);
         std::copy(d, d + len, begin() + readerIndex_);
     }
 
-    ssize_t readFd(int fd, int *savedErrno);
+    // read no more than maxBytes
+    ssize_t readFd(int fd, int *savedErrno, size_t maxBytes = SIZE_MAX);
 
 private:
+    enum ScanKind { kScanDelimiter = 1, kScanAnyOf = 2 };
+
+    static uint64_t scanKey(ScanKind kind, std::string_view bytes);
+    const char *resumeScan(uint64_t key) const;
+    void saveScan(uint64_t key, const char *found, size_t overlap) const;
+
     char *begin()
-    { return &*buffer_.begin(); }
+    { return buffer_.data(); }
 
     const char *begin() const
-    { return &*buffer_.begin(); }
+    { return buffer_.data(); }
 
     void makeSpace(size_t len)
     {
-        if (writableBytes() + prependableBytes() < len + kCheapPrepend) {
+        if (buffer_.empty()) {
+            buffer_.resize(kCheapPrepend + len);
+            readerIndex_ = kCheapPrepend;
+            writerIndex_ = kCheapPrepend;
+        } else if (writableBytes() + prependableBytes() < len + kCheapPrepend) {
             buffer_.resize(writerIndex_ + len);
         } else {
             assert(kCheapPrepend < readerIndex_);
             size_t readable = readableBytes();
+            scanIndex_ = scanIndex_ > readerIndex_
+                         ? scanIndex_ - readerIndex_ + kCheapPrepend : 0;
             std::copy(begin() + readerIndex_,
                       begin() + writerIndex_,
                       begin() + kCheapPrepend);
@@ -312,10 +338,38 @@ private:
     std::vector<char> buffer_;
     size_t readerIndex_;
     size_t writerIndex_;
+    // no match for scanKey_ in [readerIndex_, scanIndex_)
+    mutable size_t scanIndex_;
+    mutable uint64_t scanKey_;
 
     static const char kCRLF[];
 };
 
+// storage of connection input buffers, one per EventLoop.
+// not thread safe, only used in loop thread
+class BufferPool: noncopyable
+{
+public:
+    explicit
+    BufferPool(size_t maxFreeBuffers = 1024);
+
+    // give storage to an empty buffer
+    void get(Buffer& buffer);
+    // take the storage of an empty buffer back,
+    // leave it allocating nothing
+    void put(Buffer& buffer);
+
+    size_t freeBuffers() const
+    { return free_.size(); }
+
+private:
+    // larger buffers are freed rather than pooled
+    static const size_t kMaxPooledCapacity = 64 * 1024;
+
+    std::vector<Buffer> free_;
+    const size_t maxFree_;
+};
+
 }
 
 #endif  // TINYEV_BUFFER_H
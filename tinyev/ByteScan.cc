@@ -0,0 +1,155 @@
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include <tinyev/ByteScan.h>
+
+using namespace ev;
+
+namespace
+{
+
+#if defined(__AVX2__)
+
+typedef __m256i Vec;
+const size_t kWidth = 32;
+
+inline Vec load(const char* p)
+{ return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+
+inline Vec splat(char c)
+{ return _mm256_set1_epi8(c); }
+
+inline Vec equal(Vec a, Vec b)
+{ return _mm256_cmpeq_epi8(a, b); }
+
+inline Vec both(Vec a, Vec b)
+{ return _mm256_and_si256(a, b); }
+
+inline Vec either(Vec a, Vec b)
+{ return _mm256_or_si256(a, b); }
+
+inline uint32_t mask(Vec v)
+{ return static_cast<uint32_t>(_mm256_movemask_epi8(v)); }
+
+#define TINYEV_SIMD_SCAN
+
+#elif defined(__SSE2__)
+
+typedef __m128i Vec;
+const size_t kWidth = 16;
+
+inline Vec load(const char* p)
+{ return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+
+inline Vec splat(char c)
+{ return _mm_set1_epi8(c); }
+
+inline Vec equal(Vec a, Vec b)
+{ return _mm_cmpeq_epi8(a, b); }
+
+inline Vec both(Vec a, Vec b)
+{ return _mm_and_si128(a, b); }
+
+inline Vec either(Vec a, Vec b)
+{ return _mm_or_si128(a, b); }
+
+inline uint32_t mask(Vec v)
+{ return static_cast<uint32_t>(_mm_movemask_epi8(v)); }
+
+#define TINYEV_SIMD_SCAN
+
+#endif
+
+// compare against each byte of the set in one pass up to this size
+const size_t kMaxVectorSet = 16;
+
+const char* scalarDelimiter(const char* begin, const char* end,
+                            const char* delim, size_t len)
+{
+    const char* found = std::search(begin, end, delim, delim + len);
+    return found == end ? nullptr : found;
+}
+
+const char* scalarAnyOf(const char* begin, const char* end,
+                        const char* set, size_t len)
+{
+    bool table[256] = {false};
+    for (size_t i = 0; i < len; ++i)
+        table[static_cast<unsigned char>(set[i])] = true;
+    for (const char* p = begin; p < end; ++p)
+        if (table[static_cast<unsigned char>(*p)])
+            return p;
+    return nullptr;
+}
+
+}
+
+const char* ev::scanCRLF(const char* begin, const char* end)
+{
+    return scanDelimiter(begin, end, "\r\n", 2);
+}
+
+const char* ev::scanDelimiter(const char* begin, const char* end,
+                              const char* delim, size_t len)
+{
+    if (len == 0)
+        return begin;
+    if (static_cast<size_t>(end - begin) < len)
+        return nullptr;
+    if (len == 1)
+        return static_cast<const char*>(
+                memchr(begin, delim[0], static_cast<size_t>(end - begin)));
+
+    const char* p = begin;
+#ifdef TINYEV_SIMD_SCAN
+    // match the first and the last byte of delim in parallel,
+    // then verify the candidates
+    const Vec first = splat(delim[0]);
+    const Vec last = splat(delim[len - 1]);
+    for (; static_cast<size_t>(end - p) >= kWidth + len - 1; p += kWidth) {
+        uint32_t bits = mask(both(equal(load(p), first),
+                                  equal(load(p + len - 1), last)));
+        while (bits != 0) {
+            const char* candidate = p + __builtin_ctz(bits);
+            if (memcmp(candidate + 1, delim + 1, len - 2) == 0)
+                return candidate;
+            bits &= bits - 1;
+        }
+    }
+#endif
+    return scalarDelimiter(p, end, delim, len);
+}
+
+const char* ev::scanAnyOf(const char* begin, const char* end,
+                          const char* set, size_t len)
+{
+    if (len == 0 || begin >= end)
+        return nullptr;
+    if (len == 1)
+        return static_cast<const char*>(
+                memchr(begin, set[0], static_cast<size_t>(end - begin)));
+
+    const char* p = begin;
+#ifdef TINYEV_SIMD_SCAN
+    if (len <= kMaxVectorSet) {
+        Vec needles[kMaxVectorSet];
+        for (size_t i = 0; i < len; ++i)
+            needles[i] = splat(set[i]);
+        for (; static_cast<size_t>(end - p) >= kWidth; p += kWidth) {
+            Vec v = load(p);
+            Vec hit = equal(v, needles[0]);
+            for (size_t i = 1; i < len; ++i)
+                hit = either(hit, equal(v, needles[i]));
+            uint32_t bits = mask(hit);
+            if (bits != 0)
+                return p + __builtin_ctz(bits);
+        }
+    }
+#endif
+    return scalarAnyOf(p, end, set, len);
+}
@@ -0,0 +1,25 @@
+#ifndef TINYEV_BYTESCAN_H
+#define TINYEV_BYTESCAN_H
+
+#include <cstddef>
+
+namespace ev
+{
+
+// delimiter searches over [begin, end), return nullptr if not found.
+// they use AVX2 or SSE2 when the target has it, scalar code otherwise
+
+// first "\r\n"
+const char* scanCRLF(const char* begin, const char* end);
+
+// first occurrence of delim[0, len)
+const char* scanDelimiter(const char* begin, const char* end,
+                          const char* delim, size_t len);
+
+// first byte that is one of set[0, len)
+const char* scanAnyOf(const char* begin, const char* end,
+                      const char* set, size_t len);
+
+}
+
+#endif //TINYEV_BYTESCAN_H
@@ -6,7 +6,11 @@
 #define TINYEV_CALLBACKS_H
 
 #include <memory>
+#include <cstdint>
 #include <functional>
+#include <string_view>
+
+#include <tinyev/InlineFunction.h>
 
 namespace ev
 {
@@ -21,12 +25,18 @@ using std::placeholders::_5;
 class Buffer;
 class TcpConnection;
 class InetAddress;
+class Payload;
 
 typedef std::shared_ptr<TcpConnection> TcpConnectionPtr;
+// loop index, slot and generation of a server connection, 0 for none.
+// see TcpServerSingle
+typedef uint64_t ConnectionId;
+typedef std::shared_ptr<const Payload> PayloadPtr;
 typedef std::function<void(const TcpConnectionPtr&)> CloseCallback;
 typedef std::function<void(const TcpConnectionPtr&)> ConnectionCallback;
 typedef std::function<void(const TcpConnectionPtr&)> WriteCompleteCallback;
 typedef std::function<void(const TcpConnectionPtr&, size_t)> HighWaterMarkCallback;
+typedef std::function<void(const TcpConnectionPtr&, size_t)> LowWaterMarkCallback;
 typedef std::function<void(const TcpConnectionPtr&, Buffer&)> MessageCallback;
 
 typedef std::function<void()> ErrorCallback;
@@ -34,9 +44,25 @@ typedef std::function<void(int sockfd,
                            const InetAddress& local,
                            const InetAddress& peer)> NewConnectionCallback;
 
-typedef std::function<void()> Task;
+// the callbacks of a connection. one copy is shared by the connections
+// of a server or client, setting one on a connection copies it first
+struct ConnectionCallbacks
+{
+    MessageCallback message;
+    WriteCompleteCallback writeComplete;
+    HighWaterMarkCallback highWaterMark;
+    LowWaterMarkCallback lowWaterMark;
+    CloseCallback close;
+};
+typedef std::shared_ptr<ConnectionCallbacks> ConnectionCallbacksPtr;
+// callbacks only referred to by the caller, copied if shared
+ConnectionCallbacks& unshare(ConnectionCallbacksPtr& callbacks);
+
+// 48 bytes hold a shared_ptr plus a std::function or a std::string
+// without allocation, and fit a TaskNode of EventLoop in 64 bytes
+typedef InlineFunction<void(), 48> Task;
 typedef std::function<void(size_t index)> ThreadInitCallback;
-typedef std::function<void()> TimerCallback;
+typedef InlineFunction<void(), 48> TimerCallback;
 
 void defaultThreadInitCallback(size_t index);
 void defaultConnectionCallback(const TcpConnectionPtr& conn);
@@ -0,0 +1,302 @@
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+
+#include <tinyev/Payload.h>
+#include <tinyev/ChainBuffer.h>
+
+using namespace ev;
+
+namespace
+{
+
+// leave room for a small header when a chain starts from empty
+const size_t kCheapPrepend = 8;
+
+}
+
+const size_t Slab::kSize;
+
+SlabPool::SlabPool(size_t maxFreeSlabs)
+        : free_(nullptr),
+          numFree_(0),
+          maxFree_(maxFreeSlabs)
+{
+}
+
+SlabPool::~SlabPool()
+{
+    while (free_ != nullptr) {
+        auto next = static_cast<Slab*>(free_->next);
+        delete free_;
+        free_ = next;
+    }
+}
+
+Slab* SlabPool::get()
+{
+    Slab* slab = free_;
+    if (slab != nullptr) {
+        free_ = static_cast<Slab*>(slab->next);
+        numFree_--;
+    }
+    else slab = new Slab;
+    slab->next = nullptr;
+    slab->data = slab->storage;
+    slab->fd = -1;
+    slab->readerIndex = 0;
+    slab->writerIndex = 0;
+    return slab;
+}
+
+void SlabPool::put(Slab* slab)
+{
+    if (numFree_ < maxFree_) {
+        slab->next = free_;
+        free_ = slab;
+        numFree_++;
+    }
+    else delete slab;
+}
+
+ChainBuffer::ChainBuffer(SlabPool* pool)
+        : pool_(pool),
+          head_(nullptr),
+          tail_(nullptr),
+          readable_(0)
+{
+}
+
+ChainBuffer::~ChainBuffer()
+{
+    retrieveAll();
+}
+
+const char* ChainBuffer::pullup(size_t len)
+{
+    assert(len <= readable_);
+    assert(len <= Slab::kSize);
+    if (len == 0 || len <= head_->readableBytes())
+        return peek();
+
+    // copy into the first slab, a payload can not be written
+    Slab* head;
+    if (head_->payload != nullptr || head_->fd != -1) {
+        head = pool_->get();
+        pushFront(head);
+    }
+    else head = static_cast<Slab*>(head_);
+    if (Slab::kSize - head->readerIndex < len) {
+        size_t readable = head->readableBytes();
+        memmove(head->storage, head->storage + head->readerIndex, readable);
+        head->readerIndex = 0;
+        head->writerIndex = readable;
+    }
+    while (head->readableBytes() < len) {
+        Chunk* next = head->next;
+        assert(next->fd == -1);
+        size_t n = std::min(len - head->readableBytes(), next->readableBytes());
+        memcpy(head->storage + head->writerIndex, next->data + next->readerIndex, n);
+        head->writerIndex += n;
+        next->readerIndex += n;
+        if (next->readableBytes() == 0) {
+            head->next = next->next;
+            if (tail_ == next)
+                tail_ = head;
+            next->next = nullptr;
+            release(next);
+        }
+    }
+    return peek();
+}
+
+void ChainBuffer::retrieve(size_t len)
+{
+    assert(len <= readable_);
+    readable_ -= len;
+    while (len > 0) {
+        size_t n = std::min(len, head_->readableBytes());
+        head_->readerIndex += n;
+        len -= n;
+        if (head_->readableBytes() == 0)
+            popFront();
+    }
+}
+
+void ChainBuffer::retrieveAll()
+{
+    while (head_ != nullptr)
+        popFront();
+    readable_ = 0;
+}
+
+std::string ChainBuffer::retrieveAllAsString()
+{
+    std::string result;
+    result.reserve(readable_);
+    for (Chunk* chunk = head_; chunk != nullptr; chunk = chunk->next) {
+        assert(chunk->fd == -1);
+        result.append(chunk->data + chunk->readerIndex, chunk->readableBytes());
+    }
+    retrieveAll();
+    return result;
+}
+
+void ChainBuffer::append(const char* data, size_t len)
+{
+    while (len > 0) {
+        Slab* tail = writableTail();
+        size_t n = std::min(len, tail->writableBytes());
+        memcpy(tail->storage + tail->writerIndex, data, n);
+        tail->writerIndex += n;
+        readable_ += n;
+        data += n;
+        len -= n;
+    }
+}
+
+void ChainBuffer::append(const PayloadPtr& payload, size_t offset)
+{
+    assert(offset <= payload->size());
+    if (offset == payload->size())
+        return;
+    auto chunk = new Chunk;
+    chunk->data = payload->data();
+    chunk->readerIndex = offset;
+    chunk->writerIndex = payload->size();
+    chunk->payload = payload;
+    chunk->fd = -1;
+    pushBack(chunk);
+    readable_ += chunk->readableBytes();
+}
+
+void ChainBuffer::appendFile(int fd, off_t offset, size_t len)
+{
+    assert(fd != -1 && offset >= 0);
+    if (len == 0) {
+        ::close(fd);
+        return;
+    }
+    auto chunk = new Chunk;
+    chunk->data = nullptr;
+    chunk->readerIndex = static_cast<size_t>(offset);
+    chunk->writerIndex = static_cast<size_t>(offset) + len;
+    chunk->fd = fd;
+    pushBack(chunk);
+    readable_ += len;
+}
+
+void ChainBuffer::prepend(const void* data, size_t len)
+{
+    assert(len <= Slab::kSize);
+    if (head_ == nullptr || head_->payload != nullptr ||
+        head_->fd != -1 || head_->readerIndex < len) {
+        Slab* slab = pool_->get();
+        slab->readerIndex = slab->writerIndex = Slab::kSize;
+        pushFront(slab);
+    }
+    auto head = static_cast<Slab*>(head_);
+    head->readerIndex -= len;
+    memcpy(head->storage + head->readerIndex, data, len);
+    readable_ += len;
+}
+
+ssize_t ChainBuffer::writeFd(int fd, int* savedErrno)
+{
+    if (head_ != nullptr && head_->fd != -1)
+        return sendFile(fd, savedErrno);
+
+    struct iovec vec[kMaxIovec];
+    int iovcnt = peekIovecs(vec, kMaxIovec);
+    const ssize_t n = ::writev(fd, vec, iovcnt);
+    if (n < 0)
+        *savedErrno = errno;
+    else
+        retrieve(static_cast<size_t>(n));
+    return n;
+}
+
+int ChainBuffer::peekIovecs(struct iovec* vec, int maxVec) const
+{
+    // stop at a file region
+    int iovcnt = 0;
+    for (Chunk* chunk = head_;
+         chunk != nullptr && chunk->fd == -1 && iovcnt < maxVec;
+         chunk = chunk->next) {
+        vec[iovcnt].iov_base = const_cast<char*>(chunk->data + chunk->readerIndex);
+        vec[iovcnt].iov_len = chunk->readableBytes();
+        iovcnt++;
+    }
+    return iovcnt;
+}
+
+ssize_t ChainBuffer::sendFile(int fd, int* savedErrno)
+{
+    auto offset = static_cast<off_t>(head_->readerIndex);
+    const ssize_t n = ::sendfile(fd, head_->fd, &offset, head_->readableBytes());
+    if (n < 0)
+        *savedErrno = errno;
+    else if (n == 0) {
+        // the file is shorter than the region, drop the rest
+        *savedErrno = ENODATA;
+        retrieve(head_->readableBytes());
+        return -1;
+    }
+    else
+        retrieve(static_cast<size_t>(n));
+    return n;
+}
+
+Slab* ChainBuffer::writableTail()
+{
+    if (tail_ == nullptr || tail_->payload != nullptr || tail_->fd != -1 ||
+        static_cast<Slab*>(tail_)->writableBytes() == 0) {
+        Slab* slab = pool_->get();
+        if (head_ == nullptr)
+            slab->readerIndex = slab->writerIndex = kCheapPrepend;
+        pushBack(slab);
+    }
+    return static_cast<Slab*>(tail_);
+}
+
+void ChainBuffer::pushBack(Chunk* chunk)
+{
+    chunk->next = nullptr;
+    if (tail_ == nullptr)
+        head_ = chunk;
+    else
+        tail_->next = chunk;
+    tail_ = chunk;
+}
+
+void ChainBuffer::pushFront(Chunk* chunk)
+{
+    chunk->next = head_;
+    head_ = chunk;
+    if (tail_ == nullptr)
+        tail_ = chunk;
+}
+
+void ChainBuffer::popFront()
+{
+    Chunk* chunk = head_;
+    head_ = chunk->next;
+    if (head_ == nullptr)
+        tail_ = nullptr;
+    release(chunk);
+}
+
+void ChainBuffer::release(Chunk* chunk)
+{
+    if (chunk->fd != -1) {
+        ::close(chunk->fd);
+        delete chunk;
+    }
+    else if (chunk->payload != nullptr)
+        delete chunk;
+    else
+        pool_->put(static_cast<Slab*>(chunk));
+}
@@ -0,0 +1,132 @@
+#ifndef TINYEV_CHAINBUFFER_H
+#define TINYEV_CHAINBUFFER_H
+
+#include <string>
+#include <string_view>
+#include <cassert>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <tinyev/noncopyable.h>
+#include <tinyev/Callbacks.h>
+
+namespace ev
+{
+
+// a node of ChainBuffer: a slab, a reference to a payload,
+// or a file region whose indexes are file offsets
+struct Chunk
+{
+    Chunk* next;
+    const char* data;   // nullptr for a file region
+    size_t readerIndex;
+    size_t writerIndex;
+    PayloadPtr payload; // not nullptr for a payload
+    int fd;             // not -1 for a file region, owned by the chunk
+
+    size_t readableBytes() const
+    { return writerIndex - readerIndex; }
+};
+
+struct Slab: Chunk
+{
+    static const size_t kSize = 16 * 1024;
+
+    char storage[kSize];
+
+    size_t writableBytes() const
+    { return kSize - writerIndex; }
+};
+
+// free list of slabs, one per EventLoop.
+// not thread safe, only used in loop thread
+class SlabPool: noncopyable
+{
+public:
+    explicit
+    SlabPool(size_t maxFreeSlabs = 1024);
+    ~SlabPool();
+
+    Slab* get();
+    void put(Slab* slab);
+
+    size_t freeSlabs() const
+    { return numFree_; }
+
+private:
+    Slab* free_;
+    size_t numFree_;
+    const size_t maxFree_;
+};
+
+// a chain of fixed size slabs, appending never moves existing bytes.
+// a payload is linked by reference rather than copied, and a file
+// region is sent by sendfile(2) without entering user space.
+//
+// peek() only sees the readable bytes of the first chunk,
+// call pullup() when a codec needs a contiguous view.
+// peek(), pullup() and retrieveAllAsString() must not reach a file region
+class ChainBuffer: noncopyable
+{
+public:
+    explicit
+    ChainBuffer(SlabPool* pool);
+    ~ChainBuffer();
+
+    size_t readableBytes() const
+    { return readable_; }
+
+    // first contiguous chunk of readable bytes
+    const char* peek() const
+    { return head_ == nullptr ? nullptr : head_->data + head_->readerIndex; }
+    size_t peekableBytes() const
+    { return head_ == nullptr ? 0 : head_->readableBytes(); }
+
+    // make the first len bytes contiguous, len <= Slab::kSize
+    const char* pullup(size_t len);
+
+    void retrieve(size_t len);
+    void retrieveAll();
+    std::string retrieveAllAsString();
+
+    void append(std::string_view data)
+    { append(data.data(), data.length()); }
+    void append(const void* data, size_t len)
+    { append(static_cast<const char*>(data), len); }
+    void append(const char* data, size_t len);
+
+    // bytes of payload from offset on, not copied
+    void append(const PayloadPtr& payload, size_t offset = 0);
+
+    // [offset, offset + len) of fd, takes the ownership of fd
+    void appendFile(int fd, off_t offset, size_t len);
+
+    // len <= Slab::kSize
+    void prepend(const void* data, size_t len);
+
+    // gather the readable bytes and retrieve what is written,
+    // a file region at the front goes by sendfile(2)
+    ssize_t writeFd(int fd, int* savedErrno);
+    // the readable bytes before the first file region in at most
+    // maxVec iovecs, returns how many are filled
+    int peekIovecs(struct iovec* vec, int maxVec) const;
+
+private:
+    static const int kMaxIovec = 64;
+
+    ssize_t sendFile(int fd, int* savedErrno);
+    Slab* writableTail();
+    void pushBack(Chunk* chunk);
+    void pushFront(Chunk* chunk);
+    void popFront();
+    void release(Chunk* chunk);
+
+    SlabPool* pool_;
+    Chunk* head_;
+    Chunk* tail_;
+    size_t readable_;
+};
+
+}
+
+#endif //TINYEV_CHAINBUFFER_H
@@ -9,14 +9,19 @@
 
 using namespace ev;
 
-Channel::Channel(EventLoop* loop, int fd)
+Channel::Channel(EventLoop* loop, int fd, ChannelHandler* handler)
         : polling(false),
           loop_(loop),
+          handler_(handler),
           fd_(fd),
-          tied_(false),
           events_(0),
           revents_(0),
-          handlingEvents_(false)
+          edgeTriggered_(false),
+          handlingEvents_(false),
+          ioMode_(kReadinessIo),
+          done_(0),
+          readResult_(0),
+          writeResult_(0)
 {}
 
 Channel::~Channel()
@@ -25,44 +30,26 @@ Channel::~Channel()
 void Channel::handleEvents()
 {
     loop_->assertInLoopThread();
-    // channel is always a member of another object
-    // e.g. Timer, Acceptor, TcpConnection
-    // TcpConnection is managed by std::shared_ptr,
-    // and may be destructed when handling events,
-    // so we use weak_ptr->shared_ptr to
-    // extend it's life-time.
-    if (tied_) {
-        auto guard = tie_.lock();
-        if (guard != nullptr)
-            handleEventsWithGuard();
-    }
-    else handleEventsWithGuard();
-}
-
-void Channel::handleEventsWithGuard()
-{
+    // the handler owns the channel and outlives its events,
+    // TcpConnection keeps itself alive until it is closed
     handlingEvents_ = true;
-    if ((revents_ & EPOLLHUP) && !(revents_ & EPOLLIN)) {
-        if (closeCallback_) closeCallback_();
-    }
-    if (revents_ & EPOLLERR) {
-        if (errorCallback_) errorCallback_();
-    }
-    if (revents_ & (EPOLLIN | EPOLLPRI | EPOLLRDHUP)) {
-        if (readCallback_) readCallback_();
-    }
-    if (revents_ & EPOLLOUT) {
-        if (writeCallback_) writeCallback_();
-    }
+    if ((revents_ & EPOLLHUP) && !(revents_ & EPOLLIN))
+        handler_->handleClose();
+    if (revents_ & EPOLLERR)
+        handler_->handleError();
+    if (revents_ & (EPOLLIN | EPOLLPRI | EPOLLRDHUP))
+        handler_->handleRead();
+    if (revents_ & EPOLLOUT)
+        handler_->handleWrite();
+    if (done_ & kReadDone)
+        handler_->handleReadDone(readResult_);
+    if (done_ & kWriteDone)
+        handler_->handleWriteDone(writeResult_);
+    revents_ = 0;
+    done_ = 0;
     handlingEvents_ = false;
 }
 
-void Channel::tie(const std::shared_ptr<void>& obj)
-{
-    tie_ = obj;
-    tied_ = true;
-}
-
 void Channel::update()
 {
     loop_->updateChannel(this);
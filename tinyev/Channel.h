@@ -5,9 +5,8 @@
 #ifndef TINYEV_CHANNEL_H
 #define TINYEV_CHANNEL_H
 
-#include <functional>
-#include <memory>
 #include <sys/epoll.h>
+#include <sys/uio.h>
 
 #include <tinyev/noncopyable.h>
 
@@ -16,26 +15,47 @@ namespace ev
 
 class EventLoop;
 
-class Channel: noncopyable
+// the owner of a channel, e.g. Acceptor, TimerQueue, TcpConnection.
+// one pointer per channel instead of four std::function
+class ChannelHandler
 {
 public:
-    typedef std::function<void()> ReadCallback;
-    typedef std::function<void()> WriteCallback;
-    typedef std::function<void()> CloseCallback;
-    typedef std::function<void()> ErrorCallback;
+    virtual void handleRead() {}
+    virtual void handleWrite() {}
+    virtual void handleClose() {}
+    virtual void handleError() {}
+
+    // completion IO, see Channel::setIoMode(). the memory the poller
+    // reads into (the peer address of an accept) and writes from must
+    // stay until the result comes. zero length or count submits nothing
+    virtual struct iovec readBuffer() { return {nullptr, 0}; }
+    // a zero count while writing waits for EPOLLOUT and handleWrite()
+    virtual int writeBuffers(struct iovec*, int) { return 0; }
+    // bytes read, the accepted fd or bytes written, -errno on failure
+    virtual void handleReadDone(int) {}
+    virtual void handleWriteDone(int) {}
+
+protected:
+    ~ChannelHandler() = default;
+};
 
-    Channel(EventLoop* loop, int fd);
+class Channel: noncopyable
+{
+public:
+    // readiness: the poller reports events and the handler does the IO.
+    // completion: the poller keeps a read (an accept) and a write
+    // submitted while EPOLLIN and EPOLLOUT are enabled, and reports
+    // their results. only with a poller doing completionIo()
+    enum IoMode
+    {
+        kReadinessIo,
+        kCompletionIo,
+        kAcceptIo,
+    };
+
+    Channel(EventLoop* loop, int fd, ChannelHandler* handler);
     ~Channel();
 
-    void setReadCallback(const ReadCallback& cb)
-    { readCallback_ = cb; }
-    void setWriteCallback(const WriteCallback& cb)
-    { writeCallback_ = cb; }
-    void setCloseCallback(const CloseCallback& cb)
-    { closeCallback_ = cb; }
-    void setErrorCallback(const ErrorCallback& cb)
-    { errorCallback_ = cb; }
-
     void handleEvents();
 
     bool polling;
@@ -44,11 +64,26 @@ public:
     bool isNoneEvents() const
     { return events_ == 0; }
     unsigned events() const
-    { return events_; }
+    { return edgeTriggered_ ? events_ | EPOLLET : events_; }
     void setRevents(unsigned revents)
     { revents_ = revents; }
-
-    void tie(const std::shared_ptr<void>& obj);
+    ChannelHandler* handler() const
+    { return handler_; }
+
+    // must be called before the channel is enabled
+    void setIoMode(IoMode mode)
+    { ioMode_ = mode; }
+    IoMode ioMode() const
+    { return ioMode_; }
+    bool completionIo() const
+    { return ioMode_ != kReadinessIo; }
+    void setReadDone(int result)
+    { readResult_ = result; done_ |= kReadDone; }
+    void setWriteDone(int result)
+    { writeResult_ = result; done_ |= kWriteDone; }
+    // events or results not handled yet
+    bool hasEvents() const
+    { return revents_ != 0 || done_ != 0; }
 
     void enableRead()
     { events_ |= (EPOLLIN | EPOLLPRI); update();}
@@ -64,27 +99,32 @@ public:
     bool isReading() const { return events_ & EPOLLIN; }
     bool isWriting() const { return events_ & EPOLLOUT; }
 
+    // readiness is reported once per change, handlers must read or
+    // write until EAGAIN. pollers without EPOLLET stay level-triggered
+    void setEdgeTriggered(bool on)
+    { edgeTriggered_ = on; if (polling) update(); }
+    bool isEdgeTriggered() const { return edgeTriggered_; }
+
 private:
+    static const unsigned kReadDone = 1;
+    static const unsigned kWriteDone = 2;
+
     void update();
     void remove();
 
-    void handleEventsWithGuard();
-
     EventLoop* loop_;
+    ChannelHandler* handler_;
     int fd_;
 
-    std::weak_ptr<void> tie_;
-    bool tied_;
-
     unsigned events_;
     unsigned revents_;
+    bool edgeTriggered_;
 
     bool handlingEvents_;
-
-    ReadCallback readCallback_;
-    WriteCallback writeCallback_;
-    CloseCallback closeCallback_;
-    ErrorCallback errorCallback_;
+    IoMode ioMode_;
+    unsigned done_;
+    int readResult_;
+    int writeResult_;
 };
 
 
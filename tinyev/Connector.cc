@@ -33,10 +33,8 @@ Connector::Connector(EventLoop* loop, const InetAddress& peer)
           sockfd_(createSocket()),
           connected_(false),
           started_(false),
-          channel_(loop, sockfd_)
-{
-    channel_.setWriteCallback([this](){ handleWrite();});
-}
+          channel_(loop, sockfd_, this)
+{}
 
 Connector::~Connector()
 {
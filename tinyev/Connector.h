@@ -17,7 +17,7 @@ namespace ev
 class EventLoop;
 class InetAddress;
 
-class Connector: noncopyable
+class Connector: noncopyable, private ChannelHandler
 {
 public:
     Connector(EventLoop* loop, const InetAddress& peer);
@@ -32,7 +32,7 @@ public:
     { errorCallback_ = cb; }
 
 private:
-    void handleWrite();
+    void handleWrite() override;
 
     EventLoop* loop_;
     const InetAddress peer_;
@@ -4,17 +4,24 @@
 
 #include <unistd.h>
 #include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <ratio> // std::nano::den
 #include <cassert>
+#include <cerrno>
 
 #include <tinyev/Logger.h>
 #include <tinyev/EventLoop.h>
+#include <tinyev/EPoller.h>
 
 using namespace ev;
 
 EPoller::EPoller(EventLoop* loop)
         :loop_(loop),
          events_(128),
-         epollfd_(::epoll_create1(EPOLL_CLOEXEC))
+         epollfd_(::epoll_create1(EPOLL_CLOEXEC)),
+         ctlCalls_(0),
+         waitCalls_(0),
+         hasPwait2_(true)
 {
     if (epollfd_ == -1)
         SYSFATAL("EPoller::epoll_create1()");
@@ -25,11 +32,31 @@ EPoller::~EPoller()
     ::close(epollfd_);
 }
 
-void EPoller::poll(ChannelList& activeChannels)
+void EPoller::poll(ChannelList& activeChannels, Nanosecond timeout)
 {
     loop_->assertInLoopThread();
+    flushUpdates();
     int maxEvents = static_cast<int>(events_.size());
-    int nEvents = epoll_wait(epollfd_, events_.data(), maxEvents, -1);
+    int nEvents;
+    waitCalls_++;
+    if (timeout > Nanosecond::zero() && hasPwait2_) {
+        // nanosecond timeout, epoll_wait() only takes milliseconds
+        struct timespec ts;
+        ts.tv_sec = static_cast<time_t>(timeout.count() / std::nano::den);
+        ts.tv_nsec = timeout.count() % std::nano::den;
+        nEvents = static_cast<int>(::syscall(SYS_epoll_pwait2, epollfd_, events_.data(),
+                                             maxEvents, &ts, nullptr, 0));
+        if (nEvents == -1 && errno == ENOSYS) {
+            hasPwait2_ = false;
+            nEvents = 0;
+        }
+    }
+    else {
+        // round up, never wake before the deadline
+        int ms = timeout < Nanosecond::zero() ? -1 : static_cast<int>(
+                std::chrono::ceil<Millisecond>(timeout).count());
+        nEvents = epoll_wait(epollfd_, events_.data(), maxEvents, ms);
+    }
     if (nEvents == -1) {
         if (errno != EINTR)
             SYSERR("EPoller::epoll_wait()");
@@ -48,28 +75,57 @@ void EPoller::poll(ChannelList& activeChannels)
 void EPoller::updateChannel(Channel* channel)
 {
     loop_->assertInLoopThread();
-    int op = 0;
-    if (!channel->polling) {
-        assert(!channel->isNoneEvents());
-        op = EPOLL_CTL_ADD;
-        channel->polling = true;
-    }
-    else if (!channel->isNoneEvents()) {
-        op = EPOLL_CTL_MOD;
+    int fd = channel->fd();
+    assert(fd >= 0);
+    if (registrations_.size() <= static_cast<size_t>(fd))
+        registrations_.resize(static_cast<size_t>(fd) + 1);
+
+    Registration& reg = registrations_[fd];
+    if (channel->isNoneEvents()) {
+        // delete right now, fd may be closed
+        // and reused by another channel before next poll()
+        channel->polling = false;
+        if (reg.added)
+            updateChannel(EPOLL_CTL_DEL, fd, channel, 0);
+        reg.channel = nullptr;
+        reg.added = false;
     }
     else {
-        op = EPOLL_CTL_DEL;
-        channel->polling = false;
+        assert(reg.channel == nullptr || reg.channel == channel);
+        channel->polling = true;
+        reg.channel = channel;
+        reg.events = channel->events();
+        if (!reg.dirty) {
+            reg.dirty = true;
+            dirtyFds_.push_back(fd);
+        }
+    }
+}
+
+void EPoller::flushUpdates()
+{
+    for (int fd: dirtyFds_) {
+        Registration& reg = registrations_[fd];
+        reg.dirty = false;
+        // removed, or changed back to what the kernel knows
+        if (reg.channel == nullptr ||
+            (reg.added && reg.ctlEvents == reg.events))
+            continue;
+        updateChannel(reg.added ? EPOLL_CTL_MOD : EPOLL_CTL_ADD,
+                      fd, reg.channel, reg.events);
+        reg.added = true;
+        reg.ctlEvents = reg.events;
     }
-    updateChannel(op, channel);
+    dirtyFds_.clear();
 }
 
-void EPoller::updateChannel(int op, Channel* channel)
+void EPoller::updateChannel(int op, int fd, Channel* channel, unsigned events)
 {
     struct epoll_event ee;
-    ee.events = channel->events();
+    ee.events = events;
     ee.data.ptr = channel;
-    int ret = ::epoll_ctl(epollfd_, op, channel->fd(), &ee);
+    ctlCalls_++;
+    int ret = ::epoll_ctl(epollfd_, op, fd, &ee);
     if (ret == -1)
         SYSERR("EPoller::epoll_ctl()");
 }
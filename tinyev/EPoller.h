@@ -7,31 +7,51 @@
 
 #include <vector>
 
-#include <tinyev/noncopyable.h>
+#include <tinyev/Poller.h>
 
 namespace ev
 {
 
-class EventLoop;
-class Channel;
-
-class EPoller: noncopyable
+// interest changes of one loop iteration are recorded per fd and
+// applied before next epoll_wait(), so a channel toggling EPOLLOUT
+// back and forth costs at most one epoll_ctl()
+class EPoller: public Poller
 {
 public:
-    typedef std::vector<Channel*> ChannelList;
-
     explicit
     EPoller(EventLoop* loop);
-    ~EPoller();
+    ~EPoller() override;
 
-    void poll(ChannelList& activeChannels);
-    void updateChannel(Channel* channel);
+    void poll(ChannelList& activeChannels, Nanosecond timeout) override;
+    void updateChannel(Channel* channel) override;
+
+    uint64_t ctlCalls() const override
+    { return ctlCalls_; }
+    uint64_t syscalls() const override
+    { return ctlCalls_ + waitCalls_; }
 
 private:
-    void updateChannel(int op, Channel* channel);
+    struct Registration
+    {
+        Channel* channel = nullptr;
+        unsigned events = 0;      // wanted by the channel
+        unsigned ctlEvents = 0;   // known by the kernel
+        bool added = false;
+        bool dirty = false;
+    };
+
+    void flushUpdates();
+    void updateChannel(int op, int fd, Channel* channel, unsigned events);
+
     EventLoop* loop_;
     std::vector<struct epoll_event> events_;
     int epollfd_;
+    // indexed by fd
+    std::vector<Registration> registrations_;
+    std::vector<int> dirtyFds_;
+    uint64_t ctlCalls_;
+    uint64_t waitCalls_;
+    bool hasPwait2_; // kernel 5.11+
 };
 
 }
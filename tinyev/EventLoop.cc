@@ -20,10 +20,14 @@ namespace
 {
 
 __thread EventLoop* t_Eventloop = nullptr;
+__thread pid_t t_cachedTid = 0;
 
-pid_t gettid()
+pid_t currentTid()
 {
-    return static_cast<pid_t>(::syscall(SYS_gettid));
+    // one syscall per thread, isInLoopThread() is on every hot path
+    if (t_cachedTid == 0)
+        t_cachedTid = static_cast<pid_t>(::syscall(SYS_gettid));
+    return t_cachedTid;
 }
 
 class IgnoreSigPipe
@@ -39,19 +43,29 @@ IgnoreSigPipe ignore;
 
 }
 
-EventLoop::EventLoop()
-        : tid_(gettid()),
+EventLoop::EventLoop(PollerType type)
+        : tid_(currentTid()),
           quit_(false),
-          doingPendingTasks_(false),
-          poller_(this),
+          pollerType_(type),
+          poller_(Poller::newPoller(this, type)),
+          iteration_(0),
+          connectionPool_(std::make_shared<ObjectPool>()),
           wakeupFd_(::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)),
-          wakeupChannel_(this, wakeupFd_),
-          timerQueue_(this)
+          wakeupChannel_(this, wakeupFd_, this),
+          wakeupPending_(false),
+          wakeupValue_(0),
+          timerQueue_(this),
+          sharedReceive_(false),
+          receiveBuffer_(0),
+          busyPollWindow_(Nanosecond::zero()),
+          socketBusyPoll_(Microsecond::zero()),
+          numConnections_(0)
 {
     if (wakeupFd_ == -1)
         SYSFATAL("EventLoop::eventfd()");
 
-    wakeupChannel_.setReadCallback([this](){handleRead();});
+    if (completionIo())
+        wakeupChannel_.setIoMode(Channel::kCompletionIo);
     wakeupChannel_.enableRead();
 
     assert(t_Eventloop == nullptr);
@@ -60,6 +74,11 @@ EventLoop::EventLoop()
 
 EventLoop::~EventLoop()
 {
+    while (TaskNode* node = pendingTasks_.pop())
+        delete node;
+    // a read in flight writes into wakeupValue_
+    wakeupChannel_.disableAll();
+    ::close(wakeupFd_);
     assert(t_Eventloop == this);
     t_Eventloop = nullptr;
 }
@@ -69,13 +88,30 @@ void EventLoop::loop()
     assertInLoopThread();
     TRACE("EventLoop %p polling", this);
     quit_ = false;
+    now_ = clock::now();
     while (!quit_) {
         activeChannels_.clear();
-        poller_.poll(activeChannels_);
+        // don't block if tasks were queued by the loop thread itself
+        bool idle = localTasks_.empty() && afterEventTasks_.empty();
+        // spin a while after the last event in busy poll mode
+        if (idle && busyPollWindow_ > Nanosecond::zero())
+            idle = now_ - lastActive_ >= busyPollWindow_;
+        Nanosecond timeout = idle ? -1ns : 0ns;
+        if (idle && timerQueue_.pollDriven())
+            timeout = timerQueue_.timeout();
+        poller_->poll(activeChannels_, timeout);
+        now_ = clock::now();
+        ++iteration_;
+        if (busyPollWindow_ > Nanosecond::zero() && !activeChannels_.empty())
+            lastActive_ = now_;
         for (auto channel: activeChannels_)
             channel->handleEvents();
+        if (timerQueue_.pollDriven())
+            timerQueue_.expireTimers();
+        doAfterEventTasks();
         doPendingTasks();
     }
+    now_ = Timestamp();
     TRACE("EventLoop %p quit", this);
 }
 
@@ -87,14 +123,6 @@ void EventLoop::quit()
         wakeup();
 }
 
-void EventLoop::runInLoop(const Task& task)
-{
-    if (isInLoopThread())
-        task();
-    else
-        queueInLoop(task);
-}
-
 void EventLoop::runInLoop(Task&& task)
 {
     if (isInLoopThread())
@@ -103,52 +131,81 @@ void EventLoop::runInLoop(Task&& task)
         queueInLoop(std::move(task));
 }
 
-void EventLoop::queueInLoop(const Task& task)
+void EventLoop::queueInLoop(Task&& task)
 {
-    {
-        std::lock_guard<std::mutex> guard(mutex_);
-        pendingTasks_.push_back(task);
+    // in loop thread, no lock and no wakeup,
+    // next poll() will not block since localTasks_ is not empty
+    if (isInLoopThread()) {
+        localTasks_.push_back(std::move(task));
+        return;
     }
-    // if we are not in loop thread, just wake up loop thread to handle new task
-    // if we are in loop thread && doing pending task, wake up too.
-    // note that the following code has race condition:
-    //     if (doingPendingTasks_ || isInLoopThread())
-    if (!isInLoopThread() || doingPendingTasks_)
+    pendingTasks_.push(new TaskNode{{nullptr}, std::move(task)});
+    // only the first post after doPendingTasks() writes the eventfd,
+    // the following ones see wakeupPending_ and skip the syscall
+    if (!wakeupPending_.exchange(true, std::memory_order_acq_rel))
         wakeup();
 }
 
-void EventLoop::queueInLoop(Task&& task)
+void EventLoop::queueAfterEvents(Task&& task)
 {
-    {
-        std::lock_guard<std::mutex> guard(mutex_);
-        pendingTasks_.push_back(std::move(task));
-    }
-    if (!isInLoopThread() || doingPendingTasks_)
-        wakeup();
+    assertInLoopThread();
+    afterEventTasks_.push_back(std::move(task));
 }
 
-Timer* EventLoop::runAt(Timestamp when, TimerCallback callback)
+TimerId EventLoop::runAt(Timestamp when, TimerCallback callback)
 {
     return timerQueue_.addTimer(std::move(callback), when, Millisecond::zero());
 }
 
-Timer* EventLoop::runAfter(Nanosecond interval, TimerCallback callback)
+TimerId EventLoop::runAfter(Nanosecond interval, TimerCallback callback)
 {
-    return runAt(clock::now() + interval, std::move(callback));
+    return runAt(now() + interval, std::move(callback));
 }
 
-Timer* EventLoop::runEvery(Nanosecond interval, TimerCallback callback)
+TimerId EventLoop::runEvery(Nanosecond interval, TimerCallback callback)
 {
     return timerQueue_.addTimer(std::move(callback),
-                                clock::now() + interval,
+                                now() + interval,
                                 interval);
 }
 
-void EventLoop::cancelTimer(Timer* timer)
+void EventLoop::cancelTimer(TimerId timer)
 {
     timerQueue_.cancelTimer(timer);
 }
 
+bool EventLoop::resetTimer(TimerId timer, Timestamp when)
+{
+    return timerQueue_.resetTimer(timer, when);
+}
+
+void EventLoop::setTimerTick(Nanosecond tick)
+{
+    timerQueue_.setTick(tick);
+}
+
+void EventLoop::setPollTimers(bool on)
+{
+    timerQueue_.setPollDriven(on);
+}
+
+
+void EventLoop::setSharedReceiveBuffer(bool on)
+{
+    assertInLoopThread();
+    sharedReceive_ = on && !completionIo();
+    // large enough that readFd() never spills into its stack buffer
+    if (sharedReceive_)
+        receiveBuffer_.ensureWritableBytes(65536);
+}
+
+void EventLoop::setBusyPoll(Nanosecond window, Microsecond socketBusyPoll)
+{
+    assertInLoopThread();
+    busyPollWindow_ = window;
+    socketBusyPoll_ = socketBusyPoll;
+    lastActive_ = now();
+}
 
 void EventLoop::wakeup()
 {
@@ -162,7 +219,7 @@ void EventLoop::wakeup()
 void EventLoop::updateChannel(Channel* channel)
 {
     assertInLoopThread();
-    poller_.updateChannel(channel);
+    poller_->updateChannel(channel);
 }
 
 void EventLoop::removeChannel(Channel* channel)
@@ -184,22 +241,37 @@ void EventLoop::assertNotInLoopThread()
 bool EventLoop::isInLoopThread()
 {
     // tid_ is constant, don't worry about thread safety
-    return tid_ == gettid();
+    return tid_ == currentTid();
+}
+
+void EventLoop::doAfterEventTasks()
+{
+    // tasks queued by these tasks run in next iteration
+    std::vector<Task> tasks;
+    tasks.swap(afterEventTasks_);
+    for (Task& task: tasks)
+        task();
 }
 
 void EventLoop::doPendingTasks()
 {
     assertInLoopThread();
+
+    // tasks queued by these tasks run in next iteration
     std::vector<Task> tasks;
-    {
-        // shorten the critical area by a single swap
-        std::lock_guard<std::mutex> guard(mutex_);
-        tasks.swap(pendingTasks_);
-    }
-    doingPendingTasks_ = true;
+    tasks.swap(localTasks_);
     for (Task& task: tasks)
         task();
-    doingPendingTasks_ = false;
+
+    // clear the flag before draining, a producer that pushes after
+    // the drain will see false and wake us up again. a producer that
+    // saw true made its push before this exchange, both being RMWs on
+    // the flag, so acquire here makes its node visible to the drain
+    wakeupPending_.exchange(false, std::memory_order_acq_rel);
+    while (TaskNode* node = pendingTasks_.pop()) {
+        node->task();
+        delete node;
+    }
 }
 
 void EventLoop::handleRead()
@@ -208,4 +280,18 @@ void EventLoop::handleRead()
     ssize_t n = ::read(wakeupFd_, &one, sizeof(one));
     if (n != sizeof(one))
         SYSERR("EventLoop::handleRead() should ::read() %lu bytes", sizeof(one));
+}
+
+struct iovec EventLoop::readBuffer()
+{
+    return {&wakeupValue_, sizeof(wakeupValue_)};
+}
+
+void EventLoop::handleReadDone(int result)
+{
+    // the read has reset the eventfd, the tasks run after events
+    if (result != sizeof(wakeupValue_)) {
+        errno = result < 0 ? -result : 0;
+        SYSERR("EventLoop::handleReadDone() read %d bytes", result);
+    }
 }
\ No newline at end of file
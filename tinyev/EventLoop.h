@@ -6,59 +6,164 @@
 #define TINYEV_EVENTLOOP_H
 
 #include <atomic>
-#include <mutex>
+#include <memory>
 #include <vector>
 #include <sys/types.h>
 
 #include <tinyev/Timer.h>
-#include <tinyev/EPoller.h>
+#include <tinyev/Poller.h>
 #include <tinyev/TimerQueue.h>
+#include <tinyev/MpscQueue.h>
+#include <tinyev/ChainBuffer.h>
+#include <tinyev/ObjectPool.h>
+#include <tinyev/Buffer.h>
 
 namespace ev
 {
 
-class EventLoop: noncopyable
+class EventLoop: noncopyable, private ChannelHandler
 {
 public:
 
-    EventLoop();
+    explicit
+    EventLoop(PollerType type = kEPollPoller);
     ~EventLoop();
 
     void loop();
     void quit(); // thread safe
 
-    void runInLoop(const Task& task);
     void runInLoop(Task&& task);
-    void queueInLoop(const Task& task);
     void queueInLoop(Task&& task);
+    // run in loop thread after the events of this iteration are handled,
+    // e.g. TcpConnection flushes batched writes here
+    void queueAfterEvents(Task&& task);
 
-    Timer* runAt(Timestamp when, TimerCallback callback);
-    Timer* runAfter(Nanosecond interval, TimerCallback callback);
-    Timer* runEvery(Nanosecond interval, TimerCallback callback);
-    void cancelTimer(Timer* timer);
+    // return of the last poll() in loop thread while looping, without
+    // a clock read, otherwise clock::now(). a timer added by runAfter()
+    // counts from it, so may fire early by the time spent on events
+    Timestamp now()
+    { return isInLoopThread() && now_ != Timestamp() ? now_ : clock::now(); }
+
+    TimerId runAt(Timestamp when, TimerCallback callback);
+    TimerId runAfter(Nanosecond interval, TimerCallback callback);
+    TimerId runEvery(Nanosecond interval, TimerCallback callback);
+    // no-op if the timer has fired (one shot) or been canceled
+    void cancelTimer(TimerId timer);
+    // move a pending timer to when in place, false if it has fired
+    // (one shot) or been canceled. must be called in loop thread
+    bool resetTimer(TimerId timer, Timestamp when);
+    // granularity of timers, 1ms by default.
+    // must be called in loop thread before any timer is added
+    void setTimerTick(Nanosecond tick);
+    // pass the next timer deadline as the timeout of poll() instead of
+    // arming a timerfd, saves a syscall per earliest timer change.
+    // precision is then bounded by the tick, not by epoll_wait()'s 1ms.
+    // must be called in loop thread
+    void setPollTimers(bool on);
+    bool pollTimers() const
+    { return timerQueue_.pollDriven(); }
 
     void wakeup();
 
     void updateChannel(Channel* channel);
     void removeChannel(Channel* channel);
 
+    PollerType pollerType() const
+    { return pollerType_; }
+    // number of poll() returns, not thread safe
+    uint64_t iteration() const
+    { return iteration_; }
+    // number of epoll_ctl() calls, not thread safe
+    uint64_t ctlCalls() const
+    { return poller_->ctlCalls(); }
+    // number of syscalls made by the poller, not thread safe
+    uint64_t pollerSyscalls() const
+    { return poller_->syscalls(); }
+    // the poller does the IO of connections, see Channel::setIoMode()
+    bool completionIo() const
+    { return poller_->completionIo(); }
+
+    // slabs of connection output buffers, not thread safe
+    SlabPool* slabPool()
+    { return &slabPool_; }
+    // storage of the connections of this loop, see ObjectPool
+    const std::shared_ptr<ObjectPool>& connectionPool() const
+    { return connectionPool_; }
+
+    // connections created afterwards read into one per-loop buffer and
+    // only hold input memory while a message is incomplete. no effect
+    // with completionIo(), a read in flight owns its buffer.
+    // must be called in loop thread
+    void setSharedReceiveBuffer(bool on);
+    bool sharedReceiveBuffer() const
+    { return sharedReceive_; }
+    Buffer& receiveBuffer()
+    { return receiveBuffer_; }
+    BufferPool* bufferPool()
+    { return &bufferPool_; }
+
+    // keep polling without blocking for window after the last event,
+    // trading CPU for wakeup latency, zero disables it. connections
+    // created afterwards also set SO_BUSY_POLL to socketBusyPoll if it
+    // is not zero. must be called in loop thread
+    void setBusyPoll(Nanosecond window,
+                     Microsecond socketBusyPoll = Microsecond::zero());
+    Microsecond socketBusyPoll() const
+    { return socketBusyPoll_; }
+
+    // connected TcpConnections of this loop, read by any thread to
+    // balance load, see EventLoopThreadPool. only loop thread changes it
+    size_t numConnections() const
+    { return numConnections_.load(std::memory_order_relaxed); }
+    void connectionOpened()
+    { numConnections_.store(numConnections() + 1, std::memory_order_relaxed); }
+    void connectionClosed()
+    { numConnections_.store(numConnections() - 1, std::memory_order_relaxed); }
+
     void assertInLoopThread();
     void assertNotInLoopThread();
     bool isInLoopThread();
 
 private:
+    struct TaskNode
+    {
+        std::atomic<TaskNode*> next;
+        Task task;
+    };
+
+    void doAfterEventTasks();
     void doPendingTasks();
-    void handleRead();
+    void handleRead() override;
+    struct iovec readBuffer() override;
+    void handleReadDone(int result) override;
     const pid_t tid_;
     std::atomic_bool quit_;
-    bool doingPendingTasks_;
-    EPoller poller_;
-    EPoller::ChannelList activeChannels_;
+    const PollerType pollerType_;
+    std::unique_ptr<Poller> poller_;
+    Poller::ChannelList activeChannels_;
+    uint64_t iteration_;
+    // before the tasks and timers, which may hold connections that give
+    // their memory back to these pools when they are destroyed
+    SlabPool slabPool_;
+    std::shared_ptr<ObjectPool> connectionPool_;
+    BufferPool bufferPool_;
     const int wakeupFd_;
     Channel wakeupChannel_;
-    std::mutex mutex_;
-    std::vector<Task> pendingTasks_; // guarded by mutex_
+    // set by the first producer of a burst, cleared before draining,
+    // so N cross-thread posts cost one eventfd write
+    std::atomic_bool wakeupPending_;
+    uint64_t wakeupValue_; // read by the poller in completion IO
+    MpscQueue<TaskNode> pendingTasks_; // cross-thread tasks
+    std::vector<Task> localTasks_;     // tasks queued in loop thread
+    std::vector<Task> afterEventTasks_;
     TimerQueue timerQueue_;
+    bool sharedReceive_;
+    Buffer receiveBuffer_;
+    Nanosecond busyPollWindow_;
+    Microsecond socketBusyPoll_;
+    std::atomic<size_t> numConnections_;
+    Timestamp lastActive_; // last poll() returning events
+    Timestamp now_;        // zero if not looping
 };
 
 }
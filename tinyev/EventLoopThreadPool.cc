@@ -0,0 +1,107 @@
+#include <cassert>
+
+#include <tinyev/EventLoop.h>
+#include <tinyev/CountDownLatch.h>
+#include <tinyev/EventLoopThreadPool.h>
+
+using namespace ev;
+
+EventLoopThreadPool::EventLoopThreadPool(size_t numThreads, PollerType type)
+        : pollerType_(type),
+          started_(false),
+          strategy_(kRoundRobin),
+          next_(0),
+          loops_(numThreads, nullptr),
+          looping_(numThreads),
+          destroyLatch_(1)
+{
+}
+
+EventLoopThreadPool::~EventLoopThreadPool()
+{
+    // a loop that quit on its own is still alive, waiting for the latch
+    for (size_t i = 0; i < loops_.size(); ++i)
+        if (looping_[i])
+            loops_[i]->quit();
+    destroyLatch_.count();
+    for (auto& thread: threads_)
+        thread.join();
+}
+
+void EventLoopThreadPool::start(const ThreadInitCallback& cb)
+{
+    assert(!started_);
+    started_ = true;
+
+    // one latch for all, the threads build their loops at the same time
+    CountDownLatch latch(static_cast<int>(loops_.size()));
+    for (size_t i = 0; i < loops_.size(); ++i)
+        threads_.emplace_back([this, i, &cb, &latch]() {
+            runInThread(i, cb, latch);
+        });
+    latch.wait();
+}
+
+void EventLoopThreadPool::runInThread(size_t index,
+                                      const ThreadInitCallback& cb,
+                                      CountDownLatch& latch)
+{
+    EventLoop loop(pollerType_);
+    loops_[index] = &loop;
+    looping_[index] = true;
+    cb(index);
+    // cb and latch are gone after this
+    latch.count();
+    loop.loop();
+    looping_[index] = false;
+    // loops_ keeps pointing here until the pool is destroyed
+    destroyLatch_.wait();
+}
+
+EventLoop* EventLoopThreadPool::getNextLoop(size_t key)
+{
+    assert(started_);
+    if (loops_.empty())
+        return nullptr;
+
+    size_t index;
+    if (selector_)
+        index = selector_(*this, key);
+    else if (strategy_ == kLeastConnections)
+        index = leastConnections();
+    else if (strategy_ == kHashByKey)
+        index = key;
+    else
+        index = next_.fetch_add(1, std::memory_order_relaxed);
+    return loops_[index % loops_.size()];
+}
+
+size_t EventLoopThreadPool::leastConnections()
+{
+    // ties go round robin rather than always to the first loop
+    size_t start = next_.fetch_add(1, std::memory_order_relaxed);
+    size_t best = start % loops_.size();
+    size_t fewest = loops_[best]->numConnections();
+    for (size_t i = 1; i < loops_.size() && fewest > 0; ++i) {
+        size_t index = (start + i) % loops_.size();
+        size_t n = loops_[index]->numConnections();
+        if (n < fewest) {
+            fewest = n;
+            best = index;
+        }
+    }
+    return best;
+}
+
+size_t EventLoopThreadPool::numConnections(size_t index) const
+{
+    return loops_[index]->numConnections();
+}
+
+std::vector<size_t> EventLoopThreadPool::numConnections() const
+{
+    std::vector<size_t> counts;
+    for (auto loop: loops_)
+        counts.push_back(loop->numConnections());
+    return counts;
+}
@@ -0,0 +1,85 @@
+#ifndef TINYEV_EVENTLOOPTHREADPOOL_H
+#define TINYEV_EVENTLOOPTHREADPOOL_H
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <functional>
+
+#include <tinyev/noncopyable.h>
+#include <tinyev/CountDownLatch.h>
+#include <tinyev/Callbacks.h>
+#include <tinyev/Poller.h>
+
+namespace ev
+{
+
+class EventLoop;
+
+// EventLoop threads shared by servers, client fleets and applications.
+// the threads start in parallel and start() returns once all of their
+// loops are running. the loops quit when the pool goes away and live
+// as long as it, even if one quits earlier
+class EventLoopThreadPool: noncopyable
+{
+public:
+    // how getNextLoop() picks a loop
+    enum Strategy
+    {
+        kRoundRobin,
+        kLeastConnections, // fewest open connections, see EventLoop
+        kHashByKey,        // key modulo the number of loops
+    };
+    // index of the loop for a key, overrides the strategy.
+    // called by any thread
+    typedef std::function<size_t(const EventLoopThreadPool& pool,
+                                 size_t key)> Selector;
+
+    explicit
+    EventLoopThreadPool(size_t numThreads, PollerType type = kEPollPoller);
+    ~EventLoopThreadPool();
+
+    // cb runs in each thread before its loop starts
+    void start(const ThreadInitCallback& cb = defaultThreadInitCallback);
+    bool started() const
+    { return started_; }
+
+    // must be called before start()
+    void setStrategy(Strategy strategy)
+    { strategy_ = strategy; }
+    void setSelector(const Selector& selector)
+    { selector_ = selector; }
+
+    // thread safe after start(), nullptr for an empty pool
+    EventLoop* getNextLoop(size_t key = 0);
+
+    size_t size() const
+    { return loops_.size(); }
+    EventLoop* getLoop(size_t index) const
+    { return loops_[index]; }
+    const std::vector<EventLoop*>& getAllLoops() const
+    { return loops_; }
+
+    // load of each loop, thread safe after start()
+    size_t numConnections(size_t index) const;
+    std::vector<size_t> numConnections() const;
+
+private:
+    void runInThread(size_t index, const ThreadInitCallback& cb,
+                     CountDownLatch& latch);
+    size_t leastConnections();
+
+    const PollerType pollerType_;
+    bool started_;
+    Strategy strategy_;
+    Selector selector_;
+    std::atomic<size_t> next_;
+    std::vector<EventLoop*> loops_; // fixed from start() on
+    std::vector<std::atomic_bool> looping_;
+    std::vector<std::thread> threads_;
+    CountDownLatch destroyLatch_;   // the loops are destroyed after it
+};
+
+}
+
+#endif //TINYEV_EVENTLOOPTHREADPOOL_H
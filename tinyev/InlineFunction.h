@@ -0,0 +1,167 @@
+#ifndef TINYEV_INLINEFUNCTION_H
+#define TINYEV_INLINEFUNCTION_H
+
+#include <new>
+#include <cstddef>
+#include <utility>
+#include <functional>
+#include <type_traits>
+
+namespace ev
+{
+
+template <typename Signature, size_t Capacity>
+class InlineFunction;
+
+// move-only std::function that keeps a callable of up to Capacity
+// bytes in place. std::function allocates for anything larger than two
+// pointers, e.g. a lambda capturing shared_from_this() and a string.
+// a larger or over aligned callable, or one whose move may throw,
+// still goes to heap
+template <typename R, typename... Args, size_t Capacity>
+class InlineFunction<R(Args...), Capacity>
+{
+public:
+    InlineFunction() noexcept
+            : ops_(nullptr)
+    {}
+
+    InlineFunction(std::nullptr_t) noexcept
+            : ops_(nullptr)
+    {}
+
+    template <typename F,
+              typename Functor = std::decay_t<F>,
+              typename = std::enable_if_t<
+                      !std::is_same_v<Functor, InlineFunction> &&
+                      std::is_invocable_r_v<R, Functor&, Args...>>>
+    InlineFunction(F&& f)
+            : ops_(nullptr)
+    {
+        if (isNull(f))
+            return;
+        if constexpr (kInline<Functor>) {
+            new (&storage_) Functor(std::forward<F>(f));
+            ops_ = &inlineOps<Functor>;
+        }
+        else {
+            new (&storage_) Functor*(new Functor(std::forward<F>(f)));
+            ops_ = &heapOps<Functor>;
+        }
+    }
+
+    InlineFunction(InlineFunction&& rhs) noexcept
+            : ops_(rhs.ops_)
+    {
+        if (ops_ != nullptr) {
+            ops_->relocate(&rhs.storage_, &storage_);
+            rhs.ops_ = nullptr;
+        }
+    }
+
+    InlineFunction& operator=(InlineFunction&& rhs) noexcept
+    {
+        if (this != &rhs) {
+            reset();
+            if (rhs.ops_ != nullptr) {
+                rhs.ops_->relocate(&rhs.storage_, &storage_);
+                ops_ = rhs.ops_;
+                rhs.ops_ = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    InlineFunction& operator=(std::nullptr_t) noexcept
+    {
+        reset();
+        return *this;
+    }
+
+    InlineFunction(const InlineFunction&) = delete;
+    InlineFunction& operator=(const InlineFunction&) = delete;
+
+    ~InlineFunction()
+    { reset(); }
+
+    explicit operator bool() const noexcept
+    { return ops_ != nullptr; }
+
+    R operator()(Args... args) const
+    {
+        if (ops_ == nullptr)
+            throw std::bad_function_call();
+        return ops_->invoke(&storage_, std::forward<Args>(args)...);
+    }
+
+private:
+    struct Ops
+    {
+        R (*invoke)(void* storage, Args&&... args);
+        // move construct into to and destroy from
+        void (*relocate)(void* from, void* to) noexcept;
+        void (*destroy)(void* storage) noexcept;
+    };
+
+    template <typename F>
+    static constexpr bool kInline =
+            sizeof(F) <= Capacity &&
+            alignof(F) <= alignof(void*) &&
+            std::is_nothrow_move_constructible_v<F>;
+
+    template <typename F>
+    static constexpr Ops inlineOps = {
+            [](void* storage, Args&&... args) -> R {
+                return std::invoke(*static_cast<F*>(storage),
+                                   std::forward<Args>(args)...);
+            },
+            [](void* from, void* to) noexcept {
+                new (to) F(std::move(*static_cast<F*>(from)));
+                static_cast<F*>(from)->~F();
+            },
+            [](void* storage) noexcept {
+                static_cast<F*>(storage)->~F();
+            }
+    };
+
+    template <typename F>
+    static constexpr Ops heapOps = {
+            [](void* storage, Args&&... args) -> R {
+                return std::invoke(**static_cast<F**>(storage),
+                                   std::forward<Args>(args)...);
+            },
+            [](void* from, void* to) noexcept {
+                new (to) F*(*static_cast<F**>(from));
+            },
+            [](void* storage) noexcept {
+                delete *static_cast<F**>(storage);
+            }
+    };
+
+    template <typename F>
+    static bool isNull(const F&)
+    { return false; }
+    template <typename F>
+    static bool isNull(F* f)
+    { return f == nullptr; }
+    template <typename Sig>
+    static bool isNull(const std::function<Sig>& f)
+    { return !f; }
+
+    void reset() noexcept
+    {
+        if (ops_ != nullptr) {
+            ops_->destroy(&storage_);
+            ops_ = nullptr;
+        }
+    }
+
+    static_assert(Capacity >= sizeof(void*), "no room for a heap pointer");
+
+    const Ops* ops_;
+    alignas(void*) mutable unsigned char storage_[Capacity];
+};
+
+}
+
+#endif //TINYEV_INLINEFUNCTION_H
@@ -0,0 +1,497 @@
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/epoll.h>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+#include <tinyev/Logger.h>
+#include <tinyev/EventLoop.h>
+#include <tinyev/IoUringPoller.h>
+
+using namespace ev;
+
+namespace
+{
+
+// user_data of cancel requests, their completions are ignored
+const uint64_t kCancelUserData = ~0ull;
+const unsigned kRingEntries = 1024;
+// iovecs of one write, and of the writes queued between two submits
+const int kMaxIovecs = 64;
+const size_t kIovecArena = 4096;
+const uint32_t kGenerationMask = 0xffffff;
+
+int ioUringSetup(unsigned entries, struct io_uring_params* params)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete,
+                 unsigned flags, const void* arg, size_t argSize)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, toSubmit,
+                                      minComplete, flags, arg, argSize));
+}
+
+int ioUringRegister(int fd, unsigned opcode, void* arg, unsigned nrArgs)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs));
+}
+
+template <typename T>
+T* ringAt(void* ring, unsigned offset)
+{
+    void* any = static_cast<char*>(ring) + offset;
+    return static_cast<T*>(any);
+}
+
+template <typename T>
+uint64_t toUser(T* ptr)
+{
+    return reinterpret_cast<uintptr_t>(ptr);
+}
+
+// fd:32 | generation:24 | op:8
+uint64_t makeUserData(int fd, uint32_t generation, uint8_t op)
+{
+    return (static_cast<uint64_t>(static_cast<uint32_t>(fd)) << 32) |
+           (static_cast<uint64_t>(generation & kGenerationMask) << 8) | op;
+}
+
+// cancel every request on fd and wait until they are gone
+int syncCancel(int ringfd, int fd)
+{
+    struct io_uring_sync_cancel_reg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.fd = fd;
+    arg.flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    arg.timeout.tv_sec = -1;
+    arg.timeout.tv_nsec = -1;
+    return ioUringRegister(ringfd, IORING_REGISTER_SYNC_CANCEL, &arg, 1);
+}
+
+}
+
+IoUringPoller::IoUringPoller(EventLoop* loop)
+        : loop_(loop),
+          ringfd_(-1),
+          deferTaskrun_(false),
+          completionIo_(false),
+          syscalls_(0),
+          ringPtr_(nullptr),
+          ringSize_(0),
+          sqes_(nullptr),
+          sqesSize_(0),
+          iovecs_(kIovecArena),
+          iovecsUsed_(0)
+{
+    setupRing(kRingEntries);
+}
+
+IoUringPoller::~IoUringPoller()
+{
+    ::munmap(sqes_, sqesSize_);
+    ::munmap(ringPtr_, ringSize_);
+    ::close(ringfd_);
+}
+
+void IoUringPoller::setupRing(unsigned entries)
+{
+    // only the loop thread submits, completions are posted when it
+    // enters the ring instead of interrupting it (kernel 6.1+)
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    ringfd_ = ioUringSetup(entries, &params);
+    if (ringfd_ == -1 && errno == EINVAL) {
+        memset(&params, 0, sizeof(params));
+        ringfd_ = ioUringSetup(entries, &params);
+    }
+    if (ringfd_ == -1)
+        SYSFATAL("IoUringPoller::io_uring_setup()");
+    deferTaskrun_ = params.flags & IORING_SETUP_DEFER_TASKRUN;
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) ||
+        !(params.features & IORING_FEAT_EXT_ARG))
+        FATAL("IoUringPoller: kernel does not support single mmap or ext arg");
+
+    // reads and writes need iovecs taken at submit and cancels that
+    // wait (kernel 6.0+), otherwise connections go by readiness
+    completionIo_ = (params.features & IORING_FEAT_SUBMIT_STABLE) &&
+                    syncCancel(ringfd_, -1) == -1 && errno == EBADF;
+
+    size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ringSize_ = std::max(sqSize, cqSize);
+    ringPtr_ = ::mmap(nullptr, ringSize_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ringfd_, IORING_OFF_SQ_RING);
+    if (ringPtr_ == MAP_FAILED)
+        SYSFATAL("IoUringPoller::mmap() ring");
+
+    sqesSize_ = params.sq_entries * sizeof(struct io_uring_sqe);
+    void* sqes = ::mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ringfd_, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+        SYSFATAL("IoUringPoller::mmap() sqes");
+    sqes_ = static_cast<struct io_uring_sqe*>(sqes);
+
+    sqHead_ = ringAt<unsigned>(ringPtr_, params.sq_off.head);
+    sqTail_ = ringAt<unsigned>(ringPtr_, params.sq_off.tail);
+    sqMask_ = *ringAt<unsigned>(ringPtr_, params.sq_off.ring_mask);
+    sqArray_ = ringAt<unsigned>(ringPtr_, params.sq_off.array);
+
+    cqHead_ = ringAt<unsigned>(ringPtr_, params.cq_off.head);
+    cqTail_ = ringAt<unsigned>(ringPtr_, params.cq_off.tail);
+    cqMask_ = *ringAt<unsigned>(ringPtr_, params.cq_off.ring_mask);
+    cqes_ = ringAt<struct io_uring_cqe>(ringPtr_, params.cq_off.cqes);
+}
+
+void IoUringPoller::poll(ChannelList& activeChannels, Nanosecond timeout)
+{
+    loop_->assertInLoopThread();
+    flushUpdates();
+
+    unsigned flags = 0;
+    unsigned minComplete = 0;
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+
+    // requests the ring had no room for go with the next poll()
+    if (!dirtyFds_.empty())
+        timeout = Nanosecond::zero();
+    if (timeout != Nanosecond::zero()) {
+        flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+        minComplete = 1;
+        if (timeout > Nanosecond::zero()) {
+            ts.tv_sec = timeout.count() / std::nano::den;
+            ts.tv_nsec = timeout.count() % std::nano::den;
+            arg.ts = toUser(&ts);
+        }
+    }
+    else if (deferTaskrun_ || !dirtyFds_.empty()) {
+        // deferred completions are only posted in io_uring_enter(),
+        // and reaping them makes room for what the ring did not take
+        flags |= IORING_ENTER_GETEVENTS;
+    }
+
+    // submit all queued requests and wait for completions in one syscall
+    bool hasSubmission = *sqTail_ != __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+    if (hasSubmission || flags != 0) {
+        int ret = (flags & IORING_ENTER_EXT_ARG) ?
+                  enter(minComplete, flags, &arg, sizeof(arg)) :
+                  enter(minComplete, flags, nullptr, 0);
+        if (ret == -1 && errno != EINTR && errno != ETIME &&
+            errno != EBUSY && errno != EAGAIN)
+            SYSERR("IoUringPoller::io_uring_enter()");
+    }
+    reapCompletions(activeChannels);
+}
+
+void IoUringPoller::updateChannel(Channel* channel)
+{
+    loop_->assertInLoopThread();
+    int fd = channel->fd();
+    assert(fd >= 0);
+    if (registrations_.size() <= static_cast<size_t>(fd))
+        registrations_.resize(static_cast<size_t>(fd) + 1);
+
+    Registration& reg = registrations_[fd];
+    if (channel->isNoneEvents()) {
+        // cancel right now, fd may be closed and reused by another
+        // channel before next poll(), and buffers may be freed
+        channel->polling = false;
+        if (reg.readArmed || reg.writeArmed ||
+            (reg.pollArmed && !cancelPoll(fd)))
+            cancelAll(fd);
+        // late completions are ignored
+        reg.generation++;
+        reg.pollGeneration++;
+        reg.pollArmed = false;
+        reg.readArmed = false;
+        reg.readCanceled = false;
+        reg.writeArmed = false;
+        reg.channel = nullptr;
+    }
+    else {
+        assert(reg.channel == nullptr || reg.channel == channel);
+        channel->polling = true;
+        reg.channel = channel;
+        // several changes in one iteration cost one submission
+        markDirty(fd);
+    }
+}
+
+void IoUringPoller::markDirty(int fd)
+{
+    Registration& reg = registrations_[fd];
+    if (!reg.dirty) {
+        reg.dirty = true;
+        dirtyFds_.push_back(fd);
+    }
+}
+
+void IoUringPoller::flushUpdates()
+{
+    // a channel the ring has no room for stays dirty
+    size_t kept = 0;
+    for (int fd: dirtyFds_) {
+        Registration& reg = registrations_[fd];
+        if (reg.channel != nullptr && !updateRequests(fd, reg))
+            dirtyFds_[kept++] = fd;
+        else
+            reg.dirty = false;
+    }
+    dirtyFds_.resize(kept);
+}
+
+// false if a request could not be queued, the rest is done again
+bool IoUringPoller::updateRequests(int fd, Registration& reg)
+{
+    Channel* channel = reg.channel;
+    // edge-triggered and other epoll only flags are dropped
+    unsigned events = channel->events() & 0xffff;
+    if (!channel->completionIo()) {
+        if (reg.pollArmed && reg.pollEvents != events && !cancelPoll(fd))
+            return false;
+        return reg.pollArmed || events == 0 || armPoll(fd, reg, events);
+    }
+
+    // a read canceled here may still complete with data
+    if (events & EPOLLIN) {
+        if (!reg.readArmed && !armRead(fd, reg))
+            return false;
+    }
+    else if (reg.readArmed && !reg.readCanceled) {
+        uint8_t op = channel->ioMode() == Channel::kAcceptIo ? kAcceptOp : kReadOp;
+        if (!cancel(makeUserData(fd, reg.generation, op)))
+            return false;
+        reg.readCanceled = true;
+    }
+    // a write in flight is left to complete
+    if (events & EPOLLOUT)
+        return reg.writeArmed || reg.pollArmed || armWrite(fd, reg);
+    return !reg.pollArmed || cancelPoll(fd);
+}
+
+bool IoUringPoller::armPoll(int fd, Registration& reg, unsigned events)
+{
+    if (!makeRoom(0))
+        return false;
+    struct io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    // the poll has a generation of its own, canceling it
+    // must not make a read or write in flight stale
+    sqe->user_data = makeUserData(fd, reg.pollGeneration, kPollOp);
+    reg.pollArmed = true;
+    reg.pollEvents = events;
+    return true;
+}
+
+bool IoUringPoller::armRead(int fd, Registration& reg)
+{
+    if (!makeRoom(0))
+        return false;
+    struct iovec buffer = reg.channel->handler()->readBuffer();
+    if (buffer.iov_len == 0)
+        return true;
+    struct io_uring_sqe* sqe = getSqe();
+    sqe->fd = fd;
+    sqe->addr = toUser(buffer.iov_base);
+    if (reg.channel->ioMode() == Channel::kAcceptIo) {
+        reg.addrLen = static_cast<socklen_t>(buffer.iov_len);
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->addr2 = toUser(&reg.addrLen);
+        sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+        sqe->user_data = makeUserData(fd, reg.generation, kAcceptOp);
+    }
+    else {
+        // at the file position like read(2), sockets have none
+        sqe->opcode = IORING_OP_READ;
+        sqe->len = static_cast<uint32_t>(buffer.iov_len);
+        sqe->off = ~0ull;
+        sqe->user_data = makeUserData(fd, reg.generation, kReadOp);
+    }
+    reg.readArmed = true;
+    return true;
+}
+
+bool IoUringPoller::armWrite(int fd, Registration& reg)
+{
+    // no iovecs left for now, handleWrite() goes by writev(2)
+    if (!makeRoom(kMaxIovecs))
+        return armPoll(fd, reg, EPOLLOUT);
+    struct iovec* vec = getIovecs(kMaxIovecs);
+    int count = reg.channel->handler()->writeBuffers(vec, kMaxIovecs);
+    iovecsUsed_ -= static_cast<size_t>(kMaxIovecs - count);
+    // e.g. a file region, handleWrite() sends it
+    if (count == 0)
+        return armPoll(fd, reg, EPOLLOUT);
+    struct io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->addr = toUser(vec);
+    sqe->len = static_cast<uint32_t>(count);
+    sqe->off = ~0ull;
+    sqe->user_data = makeUserData(fd, reg.generation, kWriteOp);
+    reg.writeArmed = true;
+    return true;
+}
+
+void IoUringPoller::reapCompletions(ChannelList& activeChannels)
+{
+    unsigned head = *cqHead_;
+    unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        struct io_uring_cqe* cqe = &cqes_[head & cqMask_];
+        if (cqe->user_data == kCancelUserData)
+            continue;
+
+        auto fd = static_cast<int>(cqe->user_data >> 32);
+        auto generation = static_cast<uint32_t>(cqe->user_data >> 8) & kGenerationMask;
+        auto op = static_cast<uint8_t>(cqe->user_data);
+        int result = cqe->res;
+        Registration& reg = registrations_[fd];
+
+        if (op == kPollOp) {
+            // completion of a canceled request
+            if ((reg.pollGeneration & kGenerationMask) != generation ||
+                !reg.pollArmed)
+                continue;
+            // one-shot request is done, re-arm it before next wait
+            reg.pollArmed = false;
+            markDirty(fd);
+        }
+        else {
+            if ((reg.generation & kGenerationMask) != generation) {
+                // the channel is gone, so is a connection accepted for it
+                if (op == kAcceptOp && result >= 0)
+                    ::close(result);
+                continue;
+            }
+            if (op == kWriteOp)
+                reg.writeArmed = false;
+            else {
+                reg.readArmed = false;
+                reg.readCanceled = false;
+            }
+            // the next one goes with the next wait
+            markDirty(fd);
+            // nothing done, EAGAIN is not expected as the kernel polls
+            // a socket itself before it completes a request
+            if (result == -ECANCELED || result == -EAGAIN)
+                continue;
+        }
+
+        Channel* channel = reg.channel;
+        bool active = channel->hasEvents();
+        if (op == kPollOp) {
+            // like epoll, nothing but errors beyond what was asked for.
+            // EPOLLRDHUP comes along with EPOLLOUT and would read
+            // after a hang up closed the connection
+            unsigned events = static_cast<unsigned>(result) &
+                              (reg.pollEvents | EPOLLERR | EPOLLHUP);
+            channel->setRevents(result < 0 ? EPOLLERR : events);
+        }
+        else if (op == kWriteOp)
+            channel->setWriteDone(result);
+        else
+            channel->setReadDone(result);
+        // a read and a write may complete together
+        if (!active)
+            activeChannels.push_back(channel);
+    }
+    __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+}
+
+bool IoUringPoller::cancelPoll(int fd)
+{
+    Registration& reg = registrations_[fd];
+    assert(reg.pollArmed);
+    if (!cancel(makeUserData(fd, reg.pollGeneration, kPollOp)))
+        return false;
+    // late completions of the old request are ignored
+    reg.pollGeneration++;
+    reg.pollArmed = false;
+    return true;
+}
+
+bool IoUringPoller::cancel(uint64_t userData)
+{
+    if (!makeRoom(0))
+        return false;
+    struct io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = userData;
+    sqe->user_data = kCancelUserData;
+    return true;
+}
+
+void IoUringPoller::cancelAll(int fd)
+{
+    syscalls_++;
+    if (syncCancel(ringfd_, fd) == -1 && errno != ENOENT)
+        SYSERR("IoUringPoller::io_uring_register() sync cancel");
+}
+
+bool IoUringPoller::hasRoom(size_t iovecs) const
+{
+    unsigned queued = *sqTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+    return queued <= sqMask_ && iovecsUsed_ + iovecs <= iovecs_.size();
+}
+
+// an sqe and iovecs for one request, submitting the queued ones
+// without waiting if needed. the kernel may take only part of them
+// (EBUSY, EAGAIN), false if it takes none
+bool IoUringPoller::makeRoom(size_t iovecs)
+{
+    while (!hasRoom(iovecs)) {
+        int ret = enter(0, 0, nullptr, 0);
+        if (ret == -1 && errno == EINTR)
+            continue;
+        if (ret <= 0) {
+            if (ret == -1 && errno != EBUSY && errno != EAGAIN)
+                SYSERR("IoUringPoller::io_uring_enter()");
+            return false;
+        }
+    }
+    return true;
+}
+
+// makeRoom() first
+struct iovec* IoUringPoller::getIovecs(int count)
+{
+    struct iovec* vec = &iovecs_[iovecsUsed_];
+    iovecsUsed_ += static_cast<size_t>(count);
+    return vec;
+}
+
+// makeRoom() first
+struct io_uring_sqe* IoUringPoller::getSqe()
+{
+    unsigned tail = *sqTail_;
+    unsigned index = tail & sqMask_;
+    struct io_uring_sqe* sqe = &sqes_[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray_[index] = index;
+    // the kernel reads sqes only in io_uring_enter(),
+    // so it's OK to publish the tail before sqe is filled
+    __atomic_store_n(sqTail_, tail + 1, __ATOMIC_RELEASE);
+    return sqe;
+}
+
+int IoUringPoller::enter(unsigned minComplete, unsigned flags,
+                         const void* arg, size_t argSize)
+{
+    unsigned toSubmit = *sqTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+    syscalls_++;
+    int ret = ioUringEnter(ringfd_, toSubmit, minComplete, flags, arg, argSize);
+    // the kernel has copied the iovecs of what it took
+    if (*sqTail_ == __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE))
+        iovecsUsed_ = 0;
+    return ret;
+}
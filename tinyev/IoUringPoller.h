@@ -0,0 +1,116 @@
+#ifndef TINYEV_IOURINGPOLLER_H
+#define TINYEV_IOURINGPOLLER_H
+
+#include <deque>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+
+#include <tinyev/Poller.h>
+
+namespace ev
+{
+
+// io_uring based poller, a drop-in replacement of EPoller.
+//
+// a channel in completion mode (see Channel::setIoMode()) keeps an
+// IORING_OP_READ (IORING_OP_ACCEPT) submitted while it is reading and
+// an IORING_OP_WRITEV while it is writing, the next one is submitted
+// after the result is handled. other channels, and a write starting
+// at a file region, are watched by a one-shot IORING_OP_POLL_ADD
+// re-armed after its events are handled, level-triggered like EPoller.
+//
+// requests of one loop iteration are queued in the submission ring
+// and submitted together with the wait in a single io_uring_enter().
+// a channel removed with requests in flight cancels them synchronously,
+// their buffers may be freed right after.
+class IoUringPoller: public Poller
+{
+public:
+    explicit
+    IoUringPoller(EventLoop* loop);
+    ~IoUringPoller() override;
+
+    void poll(ChannelList& activeChannels, Nanosecond timeout) override;
+    void updateChannel(Channel* channel) override;
+
+    uint64_t syscalls() const override
+    { return syscalls_; }
+    bool completionIo() const override
+    { return completionIo_; }
+
+private:
+    enum Op: uint8_t
+    {
+        kPollOp,
+        kReadOp,
+        kAcceptOp,
+        kWriteOp,
+    };
+
+    struct Registration
+    {
+        Channel* channel = nullptr;
+        uint32_t generation = 0;     // of reads and writes
+        uint32_t pollGeneration = 0; // bumped by a poll cancel too
+        unsigned pollEvents = 0;
+        bool pollArmed = false;
+        bool readArmed = false;
+        bool readCanceled = false;
+        bool writeArmed = false;
+        bool dirty = false;
+        socklen_t addrLen = 0; // written by an accept in flight
+    };
+
+    void setupRing(unsigned entries);
+    void markDirty(int fd);
+    void flushUpdates();
+    bool updateRequests(int fd, Registration& reg);
+    bool armPoll(int fd, Registration& reg, unsigned events);
+    bool armRead(int fd, Registration& reg);
+    bool armWrite(int fd, Registration& reg);
+    void reapCompletions(ChannelList& activeChannels);
+    bool cancelPoll(int fd);
+    bool cancel(uint64_t userData);
+    void cancelAll(int fd);
+    bool hasRoom(size_t iovecs) const;
+    bool makeRoom(size_t iovecs);
+    struct iovec* getIovecs(int count);
+    struct io_uring_sqe* getSqe();
+    int enter(unsigned minComplete, unsigned flags, const void* arg, size_t argSize);
+
+    EventLoop* loop_;
+    int ringfd_;
+    bool deferTaskrun_;
+    bool completionIo_;
+    uint64_t syscalls_;
+
+    void* ringPtr_;
+    size_t ringSize_;
+    struct io_uring_sqe* sqes_;
+    size_t sqesSize_;
+
+    unsigned* sqHead_;
+    unsigned* sqTail_;
+    unsigned sqMask_;
+    unsigned* sqArray_;
+
+    unsigned* cqHead_;
+    unsigned* cqTail_;
+    unsigned cqMask_;
+    struct io_uring_cqe* cqes_;
+
+    // indexed by fd, a deque so addrLen stays put when it grows
+    std::deque<Registration> registrations_;
+    std::vector<int> dirtyFds_;
+    // iovecs of the queued reads and writes, the kernel copies them
+    // when it takes the request (IORING_FEAT_SUBMIT_STABLE)
+    std::vector<struct iovec> iovecs_;
+    size_t iovecsUsed_;
+};
+
+}
+
+#endif //TINYEV_IOURINGPOLLER_H
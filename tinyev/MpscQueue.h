@@ -0,0 +1,71 @@
+#ifndef TINYEV_MPSCQUEUE_H
+#define TINYEV_MPSCQUEUE_H
+
+#include <atomic>
+
+#include <tinyev/noncopyable.h>
+
+namespace ev
+{
+
+// intrusive multi-producer/single-consumer queue (Dmitry Vyukov's algorithm)
+//
+// Node must have a member `std::atomic<Node*> next`.
+// push() is wait-free and can be called from any thread,
+// pop() must only be called from the consumer thread.
+// pop() may return nullptr while a producer is in the middle of push(),
+// the producer is responsible for notifying the consumer after push().
+template <typename Node>
+class MpscQueue: noncopyable
+{
+public:
+    MpscQueue()
+            : head_(&stub_),
+              tail_(&stub_)
+    {
+        stub_.next.store(nullptr, std::memory_order_relaxed);
+    }
+
+    void push(Node* node)
+    {
+        node->next.store(nullptr, std::memory_order_relaxed);
+        Node* prev = head_.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    Node* pop()
+    {
+        Node* tail = tail_;
+        Node* next = tail->next.load(std::memory_order_acquire);
+        if (tail == &stub_) {
+            if (next == nullptr)
+                return nullptr;
+            tail_ = next;
+            tail = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+        if (next != nullptr) {
+            tail_ = next;
+            return tail;
+        }
+        // a producer has swapped head_ but not linked it yet
+        if (tail != head_.load(std::memory_order_acquire))
+            return nullptr;
+        push(&stub_);
+        next = tail->next.load(std::memory_order_acquire);
+        if (next != nullptr) {
+            tail_ = next;
+            return tail;
+        }
+        return nullptr;
+    }
+
+private:
+    std::atomic<Node*> head_; // producers
+    Node* tail_;              // consumer
+    Node stub_;
+};
+
+}
+
+#endif //TINYEV_MPSCQUEUE_H
@@ -0,0 +1,183 @@
+#include <new>
+#include <cassert>
+#include <algorithm>
+#include <functional>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include <tinyev/Logger.h>
+#include <tinyev/ObjectPool.h>
+
+using namespace ev;
+
+const size_t ObjectPool::kChunkSize;
+const size_t ObjectPool::kAlignment;
+const size_t ObjectPool::kTrimChunks;
+const int ObjectPool::kMaxNumaNodes;
+
+ObjectPool::ObjectPool()
+        : owner_(std::this_thread::get_id()),
+          blockSize_(0),
+          free_(nullptr),
+          numFree_(0),
+          trimAt_(0),
+          cursor_(nullptr),
+          end_(nullptr),
+          numaNode_(-1),
+          remoteFree_(nullptr)
+{
+}
+
+ObjectPool::~ObjectPool()
+{
+    for (void* chunk: chunks_)
+        ::munmap(chunk, kChunkSize);
+}
+
+void* ObjectPool::allocate(size_t size)
+{
+    assert(std::this_thread::get_id() == owner_);
+    if (blockSize_ == 0) {
+        blockSize_ = (size + kAlignment - 1) / kAlignment * kAlignment;
+        trimAt_ = kTrimChunks * kChunkSize / blockSize_;
+    }
+    if (size > blockSize_ || blockSize_ > kChunkSize)
+        return ::operator new(size);
+
+    if (free_ == nullptr) {
+        takeRemoteFree();
+        // all freed blocks are back in use, start over
+        trimAt_ = numFree_ + kTrimChunks * kChunkSize / blockSize_;
+    }
+    if (free_ == nullptr)
+        return newBlock();
+    Block* block = free_;
+    free_ = block->next;
+    numFree_--;
+    return block;
+}
+
+void ObjectPool::deallocate(void* p, size_t size) noexcept
+{
+    if (size > blockSize_ || blockSize_ > kChunkSize) {
+        ::operator delete(p);
+        return;
+    }
+    auto block = static_cast<Block*>(p);
+    if (std::this_thread::get_id() == owner_) {
+        block->next = free_;
+        free_ = block;
+        // nothing is changed if trim() runs out of memory
+        if (++numFree_ > trimAt_) {
+            try { trim(); }
+            catch (const std::bad_alloc&) {}
+        }
+    }
+    else {
+        // the owner takes the whole list at once, no ABA
+        block->next = remoteFree_.load(std::memory_order_relaxed);
+        while (!remoteFree_.compare_exchange_weak(block->next, block,
+                                                  std::memory_order_release,
+                                                  std::memory_order_relaxed))
+            ;
+    }
+}
+
+size_t ObjectPool::trim()
+{
+    assert(std::this_thread::get_id() == owner_);
+    takeRemoteFree();
+    size_t released = 0;
+    if (chunks_.size() > 1) {
+        // free blocks of each chunk, found by address
+        std::less<void*> before;
+        std::sort(chunks_.begin(), chunks_.end(), before);
+        auto chunkOf = [&](void* p) {
+            auto it = std::upper_bound(chunks_.begin(), chunks_.end(), p, before);
+            return static_cast<size_t>(it - chunks_.begin() - 1);
+        };
+        std::vector<size_t> freeBlocks(chunks_.size(), 0);
+        for (Block* block = free_; block != nullptr; block = block->next)
+            freeBlocks[chunkOf(block)]++;
+        // the one being carved has blocks not handed out yet
+        if (cursor_ != end_)
+            freeBlocks[chunkOf(cursor_)] = 0;
+
+        size_t perChunk = kChunkSize / blockSize_;
+        Block** link = &free_;
+        while (*link != nullptr) {
+            if (freeBlocks[chunkOf(*link)] == perChunk)
+                *link = (*link)->next;
+            else
+                link = &(*link)->next;
+        }
+        size_t kept = 0;
+        for (size_t i = 0; i < chunks_.size(); ++i) {
+            if (freeBlocks[i] == perChunk) {
+                ::munmap(chunks_[i], kChunkSize);
+                released++;
+            }
+            else chunks_[kept++] = chunks_[i];
+        }
+        chunks_.resize(kept);
+        numFree_ -= released * perChunk;
+    }
+    // not again until as many blocks are freed on top of what is left
+    trimAt_ = numFree_ + kTrimChunks * kChunkSize / std::max(blockSize_, kAlignment);
+    return released * kChunkSize;
+}
+
+int ObjectPool::currentNumaNode()
+{
+    unsigned cpu, node;
+    if (::syscall(SYS_getcpu, &cpu, &node, nullptr) == -1)
+        return -1;
+    return static_cast<int>(node);
+}
+
+void ObjectPool::takeRemoteFree()
+{
+    Block* list = remoteFree_.exchange(nullptr, std::memory_order_acquire);
+    if (list == nullptr)
+        return;
+    // keep numFree_ exact, the list is taken over rarely
+    Block* tail = list;
+    numFree_++;
+    while (tail->next != nullptr) {
+        tail = tail->next;
+        numFree_++;
+    }
+    tail->next = free_;
+    free_ = list;
+}
+
+void* ObjectPool::newBlock()
+{
+    if (cursor_ == end_) {
+        void* chunk = ::mmap(nullptr, kChunkSize, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (chunk == MAP_FAILED)
+            throw std::bad_alloc();
+        // before any page is touched
+        if (numaNode_ >= 0 && numaNode_ < kMaxNumaNodes) {
+            const size_t kBits = sizeof(unsigned long) * 8;
+            unsigned long mask[kMaxNumaNodes / kBits] = {};
+            auto node = static_cast<size_t>(numaNode_);
+            mask[node / kBits] = 1UL << (node % kBits);
+            // the kernel drops the last bit of maxnode
+            if (::syscall(SYS_mbind, chunk, kChunkSize, MPOL_PREFERRED,
+                          mask, sizeof(mask) * 8 + 1, 0) == -1)
+                SYSERR("ObjectPool::mbind() node %d", numaNode_);
+        }
+        else if (numaNode_ >= kMaxNumaNodes)
+            ERROR("ObjectPool::mbind() node %d out of range", numaNode_);
+        chunks_.push_back(chunk);
+        cursor_ = static_cast<char*>(chunk);
+        end_ = cursor_ + kChunkSize / blockSize_ * blockSize_;
+    }
+    void* block = cursor_;
+    cursor_ += blockSize_;
+    return block;
+}
@@ -0,0 +1,114 @@
+#ifndef TINYEV_OBJECTPOOL_H
+#define TINYEV_OBJECTPOOL_H
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <tinyev/noncopyable.h>
+
+namespace ev
+{
+
+// fixed size blocks carved from chunks, one pool per EventLoop.
+// the owner thread gets and puts blocks without locking, last freed
+// first reused so a block is likely still in its cache. other threads
+// push freed blocks to a lock-free list taken over by the owner when
+// its own list runs out. chunks whose blocks are all free are unmapped
+// when free blocks pile up past a high water mark, see trim()
+class ObjectPool: noncopyable
+{
+public:
+    ObjectPool();
+    ~ObjectPool();
+
+    // blocks are the size of the first allocation,
+    // other sizes go to the global heap
+    void* allocate(size_t size);
+    void deallocate(void* p, size_t size) noexcept;
+
+    // chunks mapped afterwards prefer the NUMA node, -1 leaves them to
+    // the first touch, i.e. the node of the owner thread. owner thread
+    void setNumaNode(int node)
+    { numaNode_ = node; }
+    // node of the CPU the calling thread runs on, -1 if unknown
+    static int currentNumaNode();
+
+    // unmap the chunks that have no block in use, but the one being
+    // carved. returns the bytes released. owner thread
+    size_t trim();
+
+    size_t blockSize() const
+    { return blockSize_; }
+
+private:
+    struct Block
+    {
+        Block* next;
+    };
+
+    static const size_t kChunkSize = 256 * 1024;
+    // no two blocks share a cache line
+    static const size_t kAlignment = 64;
+    // free blocks worth this many chunks above the last trim trigger one
+    static const size_t kTrimChunks = 4;
+    // nodes mbind() can be given
+    static const int kMaxNumaNodes = 1024;
+
+    void takeRemoteFree();
+    void* newBlock();
+
+    const std::thread::id owner_;
+    size_t blockSize_;
+    Block* free_;
+    size_t numFree_;   // blocks on free_
+    size_t trimAt_;    // numFree_ that triggers trim()
+    char* cursor_; // carving the last chunk
+    char* end_;
+    std::vector<void*> chunks_;
+    int numaNode_;
+    std::atomic<Block*> remoteFree_;
+};
+
+// std::allocator over an ObjectPool for std::allocate_shared(),
+// the pool lives as long as a control block refers to it
+template <typename T>
+class PoolAllocator
+{
+public:
+    typedef T value_type;
+
+    explicit
+    PoolAllocator(std::shared_ptr<ObjectPool> pool)
+            : pool_(std::move(pool))
+    {}
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>& rhs)
+            : pool_(rhs.pool_)
+    {}
+
+    T* allocate(size_t n)
+    { return static_cast<T*>(pool_->allocate(n * sizeof(T))); }
+
+    void deallocate(T* p, size_t n) noexcept
+    { pool_->deallocate(p, n * sizeof(T)); }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U>& rhs) const
+    { return pool_ == rhs.pool_; }
+    template <typename U>
+    bool operator!=(const PoolAllocator<U>& rhs) const
+    { return pool_ != rhs.pool_; }
+
+private:
+    template <typename U>
+    friend class PoolAllocator;
+
+    std::shared_ptr<ObjectPool> pool_;
+};
+
+}
+
+#endif //TINYEV_OBJECTPOOL_H
@@ -0,0 +1,58 @@
+#ifndef TINYEV_PAYLOAD_H
+#define TINYEV_PAYLOAD_H
+
+#include <string>
+#include <string_view>
+#include <cassert>
+
+#include <tinyev/noncopyable.h>
+#include <tinyev/Callbacks.h>
+
+namespace ev
+{
+
+// immutable bytes shared by reference, e.g. one message sent to many
+// connections. TcpConnection queues a reference instead of a copy
+class Payload: noncopyable
+{
+public:
+    explicit
+    Payload(std::string data)
+            : storage_(std::make_shared<const std::string>(std::move(data))),
+              data_(storage_->data()),
+              size_(storage_->size())
+    {}
+
+    static PayloadPtr make(std::string data)
+    { return std::make_shared<const Payload>(std::move(data)); }
+
+    // a sub range sharing the same storage
+    PayloadPtr slice(size_t offset, size_t len) const
+    {
+        assert(offset <= size_ && len <= size_ - offset);
+        return std::make_shared<const Payload>(storage_, data_ + offset, len);
+    }
+
+    const char* data() const
+    { return data_; }
+    size_t size() const
+    { return size_; }
+    std::string_view view() const
+    { return std::string_view(data_, size_); }
+
+    // internal use, see slice()
+    Payload(std::shared_ptr<const std::string> storage, const char* data, size_t size)
+            : storage_(std::move(storage)),
+              data_(data),
+              size_(size)
+    {}
+
+private:
+    const std::shared_ptr<const std::string> storage_;
+    const char* const data_;
+    const size_t size_;
+};
+
+}
+
+#endif //TINYEV_PAYLOAD_H
@@ -0,0 +1,15 @@
+#include <tinyev/EPoller.h>
+#include <tinyev/IoUringPoller.h>
+
+using namespace ev;
+
+Poller* Poller::newPoller(EventLoop* loop, PollerType type)
+{
+    switch (type) {
+        case kIoUringPoller:
+            return new IoUringPoller(loop);
+        case kEPollPoller:
+        default:
+            return new EPoller(loop);
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef TINYEV_POLLER_H
+#define TINYEV_POLLER_H
+
+#include <vector>
+#include <cstdint>
+
+#include <tinyev/noncopyable.h>
+#include <tinyev/Timestamp.h>
+
+namespace ev
+{
+
+class EventLoop;
+class Channel;
+
+enum PollerType
+{
+    kEPollPoller,
+    kIoUringPoller
+};
+
+// IO multiplexing interface, owned by EventLoop,
+// all functions must be called in loop thread
+class Poller: noncopyable
+{
+public:
+    typedef std::vector<Channel*> ChannelList;
+
+    virtual ~Poller() = default;
+
+    // a negative timeout blocks until events come
+    virtual void poll(ChannelList& activeChannels, Nanosecond timeout) = 0;
+    virtual void updateChannel(Channel* channel) = 0;
+
+    // interest change syscalls made so far, the ones not
+    // issuing a syscall per change report 0
+    virtual uint64_t ctlCalls() const
+    { return 0; }
+    // syscalls made by the poller itself, the waits included
+    virtual uint64_t syscalls() const = 0;
+
+    // reads, writes and accepts of channels in completion mode are
+    // submitted by the poller, see Channel::setIoMode()
+    virtual bool completionIo() const
+    { return false; }
+
+    static Poller* newPoller(EventLoop* loop, PollerType type);
+};
+
+}
+
+#endif //TINYEV_POLLER_H
@@ -13,22 +13,26 @@ TcpClient::TcpClient(EventLoop* loop, const InetAddress& peer)
         : loop_(loop),
           connected_(false),
           peer_(peer),
-          retryTimer_(nullptr),
           connector_(new Connector(loop, peer)),
           connectionCallback_(defaultConnectionCallback),
-          messageCallback_(defaultMessageCallback)
+          callbacks_(std::make_shared<ConnectionCallbacks>())
 {
     connector_->setNewConnectionCallback(std::bind(
             &TcpClient::newConnection, this, _1, _2, _3));
+    callbacks_->message = defaultMessageCallback;
+    callbacks_->close = std::bind(&TcpClient::closeConnection, this, _1);
 }
 
 TcpClient::~TcpClient()
 {
-    if (connection_ && !connection_->disconnected())
-        connection_->forceClose();
-    if (retryTimer_ != nullptr) {
-        loop_->cancelTimer(retryTimer_);
+    if (connection_ && !connection_->disconnected()) {
+        // closeCallback would come back to a destroyed client
+        if (loop_->isInLoopThread())
+            connection_->connectDestroyed();
+        else
+            connection_->forceClose();
     }
+    loop_->cancelTimer(retryTimer_);
 }
 
 void TcpClient::start()
@@ -56,15 +60,12 @@ void TcpClient::newConnection(int connfd, const InetAddress& local, const InetAd
 {
     loop_->assertInLoopThread();
     loop_->cancelTimer(retryTimer_);
-    retryTimer_ = nullptr; // avoid duplicate cancel
     connected_ = true;
-    auto conn = std::make_shared<TcpConnection>
-            (loop_, connfd, local, peer);
+    auto conn = std::allocate_shared<TcpConnection>
+            (PoolAllocator<TcpConnection>(loop_->connectionPool()),
+             loop_, connfd, local, peer);
     connection_ = conn;
-    conn->setMessageCallback(messageCallback_);
-    conn->setWriteCompleteCallback(writeCompleteCallback_);
-    conn->setCloseCallBack(std::bind(
-            &TcpClient::closeConnection, this, _1));
+    conn->setCallbacks(callbacks_);
     // enable and tie channel
     conn->connectEstablished();
     connectionCallback_(conn);
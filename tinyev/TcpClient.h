@@ -22,9 +22,9 @@ public:
     void setConnectionCallback(const ConnectionCallback& cb)
     { connectionCallback_ = cb; }
     void setMessageCallback(const MessageCallback& cb)
-    { messageCallback_ = cb; }
+    { unshare(callbacks_).message = cb; }
     void setWriteCompleteCallback(const WriteCompleteCallback& cb)
-    { writeCompleteCallback_ = cb; }
+    { unshare(callbacks_).writeComplete = cb; }
     void setErrorCallback(const ErrorCallback& cb)
     { connector_->setErrorCallback(cb); }
 
@@ -39,12 +39,11 @@ private:
     EventLoop* loop_;
     bool connected_;
     const InetAddress peer_;
-    Timer* retryTimer_;
+    TimerId retryTimer_;
     ConnectorPtr connector_;
     TcpConnectionPtr connection_;
     ConnectionCallback connectionCallback_;
-    MessageCallback messageCallback_;
-    WriteCompleteCallback writeCompleteCallback_;
+    ConnectionCallbacksPtr callbacks_;
 };
 
 }
@@ -4,9 +4,13 @@
 
 #include <cassert>
 #include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <climits>
 
 #include <tinyev/Logger.h>
 #include <tinyev/EventLoop.h>
+#include <tinyev/Payload.h>
 #include <tinyev/TcpConnection.h>
 
 using namespace ev;
@@ -44,23 +48,59 @@ void defaultMessageCallback(const TcpConnectionPtr& conn, Buffer& buffer)
     buffer.retrieveAll();
 }
 
+ConnectionCallbacks& unshare(ConnectionCallbacksPtr& callbacks)
+{
+    if (callbacks == nullptr)
+        callbacks = std::make_shared<ConnectionCallbacks>();
+    else if (callbacks.use_count() > 1)
+        callbacks = std::make_shared<ConnectionCallbacks>(*callbacks);
+    return *callbacks;
+}
+
 }
 
 TcpConnection::TcpConnection(EventLoop *loop, int sockfd,
                              const InetAddress& local,
                              const InetAddress& peer)
         : loop_(loop),
+          channel_(loop, sockfd, this),
           sockfd_(sockfd),
-          channel_(loop, sockfd_),
           state_(kConnecting),
+          localRefs_(0),
+          aboveHighMark_(false),
+          deferredFlush_(false),
+          flushQueued_(false),
+          readBudget_(0),
+          highWaterMark_(0),
+          flowHighMark_(0),
+          inputBuffer_(0),
+          outputBuffer_(loop->slabPool()),
+          throttling_(false),
+          readStopped_(false),
+          readThrottles_(0),
+          lowWaterMark_(0),
+          flowLowMark_(0),
+          idleTimeout_(Nanosecond::zero()),
+          readTimeout_(Nanosecond::zero()),
+          writeTimeout_(Nanosecond::zero()),
+          readBudgetHits_(0),
+          id_(0),
           local_(local),
           peer_(peer),
-          highWaterMark_(0)
+          flushPending_(false)
 {
-    channel_.setReadCallback([this](){handleRead();});
-    channel_.setWriteCallback([this](){handleWrite();});
-    channel_.setCloseCallback([this](){handleClose();});
-    channel_.setErrorCallback([this](){handleError();});
+    if (loop->completionIo())
+        channel_.setIoMode(Channel::kCompletionIo);
+    // storage of closed connections, warm in this loop's cache
+    if (!loop->sharedReceiveBuffer())
+        loop->bufferPool()->get(inputBuffer_);
+
+    // raising it above net.core.busy_read needs CAP_NET_ADMIN
+    if (loop->socketBusyPoll() > Microsecond::zero()) {
+        auto usec = static_cast<int>(loop->socketBusyPoll().count());
+        if (::setsockopt(sockfd_, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) == -1)
+            SYSERR("TcpConnection::setsockopt() SO_BUSY_POLL");
+    }
 
     TRACE("TcpConnection() %s fd=%d", name().c_str(), sockfd);
 }
@@ -68,6 +108,9 @@ TcpConnection::TcpConnection(EventLoop *loop, int sockfd,
 TcpConnection::~TcpConnection()
 {
     assert(state_ == kDisconnected);
+    assert(localRefs_ == 0);
+    while (OutputNode* node = pendingOutput_.pop())
+        delete node;
     ::close(sockfd_);
 
     TRACE("~TcpConnection() %s fd=%d", name().c_str(), sockfd_);
@@ -76,9 +119,51 @@ TcpConnection::~TcpConnection()
 void TcpConnection::connectEstablished()
 {
     assert(state_ == kConnecting);
+    assert(callbacks_ != nullptr);
     state_ = kConnected;
-    channel_.tie(shared_from_this());
-    channel_.enableRead();
+    // no channel tie, events never outlive self_
+    self_ = shared_from_this();
+    loop_->connectionOpened();
+    updateReading();
+    lastRead_ = lastWrite_ = loop_->now();
+    scheduleTimeout();
+}
+
+void TcpConnection::connectDestroyed()
+{
+    loop_->assertInLoopThread();
+    if (state_ == kConnected || state_ == kDisconnecting) {
+        state_ = kDisconnected;
+        loop_->connectionClosed();
+        // cancels the IO in flight on the buffers
+        loop_->removeChannel(&channel_);
+        outputBuffer_.retrieveAll();
+        releaseInput();
+        throttleSource(false);
+        loop_->cancelTimer(timeoutTimer_);
+        timeoutTimer_ = TimerId();
+    }
+    if (localRefs_ == 0)
+        releaseSelf();
+}
+
+LocalConnectionPtr TcpConnection::localPtr()
+{
+    loop_->assertInLoopThread();
+    return LocalConnectionPtr(this);
+}
+
+void TcpConnection::releaseInput()
+{
+    inputBuffer_.retrieveAll();
+    loop_->bufferPool()->put(inputBuffer_);
+}
+
+void TcpConnection::releaseSelf()
+{
+    // may be the last reference, this is gone afterwards
+    TcpConnectionPtr self;
+    self.swap(self_);
 }
 
 bool TcpConnection::connected() const
@@ -98,17 +183,51 @@ void TcpConnection::send(const char *data, size_t len)
         WARN("TcpConnection::send() not connected, give up send");
         return;
     }
-    if (loop_->isInLoopThread()) {
+    if (loop_->isInLoopThread())
         sendInLoop(data, len);
+    else
+        queueOutput(new OutputNode(std::string(data, len)));
+}
+
+void TcpConnection::send(std::string&& data)
+{
+    if (state_ != kConnected) {
+        WARN("TcpConnection::send() not connected, give up send");
+        return;
+    }
+    if (loop_->isInLoopThread())
+        sendInLoop(data.data(), data.size());
+    else
+        queueOutput(new OutputNode(std::move(data)));
+}
+
+void TcpConnection::send(const PayloadPtr& payload)
+{
+    if (state_ != kConnected) {
+        WARN("TcpConnection::send() not connected, give up send");
+        return;
+    }
+    if (loop_->isInLoopThread()) {
+        sendInLoop(payload);
     }
     else {
-        loop_->queueInLoop(
-                [ptr = shared_from_this(), str = std::string(data, data+len)]()
-                { ptr->sendInLoop(str);});
+        auto node = new OutputNode();
+        node->payload = payload;
+        queueOutput(node);
     }
 }
 
 void TcpConnection::sendInLoop(const char *data, size_t len)
+{
+    sendInLoop(data, len, nullptr);
+}
+
+void TcpConnection::sendInLoop(const PayloadPtr& payload)
+{
+    sendInLoop(payload->data(), payload->size(), payload);
+}
+
+void TcpConnection::sendInLoop(const char *data, size_t len, const PayloadPtr& payload)
 {
     loop_->assertInLoopThread();
     // kDisconnecting is OK
@@ -119,7 +238,9 @@ void TcpConnection::sendInLoop(const char *data, size_t len)
     ssize_t n = 0;
     size_t remain = len;
     bool faultError = false;
-    if (!channel_.isWriting()) {
+    // deferred flush mode leaves the write to flushInLoop(),
+    // completion mode to the poller
+    if (!deferredFlush_ && !channel_.completionIo() && !channel_.isWriting()) {
         assert(outputBuffer_.readableBytes() == 0);
         n = ::write(sockfd_, data, len);
         if (n == -1) {
@@ -131,35 +252,190 @@ void TcpConnection::sendInLoop(const char *data, size_t len)
             n = 0;
         }
         else {
+            lastWrite_ = loop_->now();
             remain -= static_cast<size_t>(n);
-            if (remain == 0 && writeCompleteCallback_) {
-                // user may send data in writeCompleteCallback_
-                // queueInLoop can break the chain
-                loop_->queueInLoop(std::bind(
-                        writeCompleteCallback_, shared_from_this()));
+            if (remain == 0 && callbacks_->writeComplete) {
+                queueWriteComplete();
             }
         }
     }
-    // todo: add highWaterMark
     if (!faultError && remain > 0) {
-        if (highWaterMarkCallback_) {
-            size_t oldLen = outputBuffer_.readableBytes();
-            size_t newLen = oldLen + remain;
-            if (oldLen < highWaterMark_ && newLen >= highWaterMark_)
-                loop_->queueInLoop(std::bind(
-                        highWaterMarkCallback_, shared_from_this(), newLen));
+        // queue a reference to the payload instead of copying it
+        if (payload != nullptr)
+            outputBuffer_.append(payload, static_cast<size_t>(data + n - payload->data()));
+        else
+            outputBuffer_.append(data + n, remain);
+        outputQueued();
+    }
+}
+
+void TcpConnection::sendFile(int fd, off_t offset, size_t len)
+{
+    if (state_ != kConnected) {
+        WARN("TcpConnection::sendFile() not connected, give up send");
+        return;
+    }
+    if (loop_->isInLoopThread()) {
+        sendFileInLoop(fd, offset, len);
+    }
+    else {
+        // caller may close fd once we return
+        auto node = new OutputNode();
+        node->fd = ::dup(fd);
+        if (node->fd == -1) {
+            SYSERR("TcpConnection::dup()");
+            delete node;
+            return;
         }
-        outputBuffer_.append(data + n, remain);
-        channel_.enableWrite();
+        node->offset = offset;
+        node->fileLen = len;
+        queueOutput(node);
     }
 }
 
-void TcpConnection::sendInLoop(const std::string& message)
+void TcpConnection::sendFileInLoop(int fd, off_t offset, size_t len)
 {
-    sendInLoop(message.data(), message.size());
+    loop_->assertInLoopThread();
+    // kDisconnecting is OK
+    if (state_ == kDisconnected) {
+        WARN("TcpConnection::sendFileInLoop() disconnected, give up send");
+        return;
+    }
+    off_t end = offset + static_cast<off_t>(len);
+    bool faultError = false;
+    if (!channel_.isWriting() && outputBuffer_.readableBytes() == 0 && len > 0) {
+        ssize_t n = ::sendfile(sockfd_, fd, &offset, len);
+        if (n == -1) {
+            if (errno != EAGAIN) {
+                SYSERR("TcpConnection::sendfile()");
+                faultError = true;
+            }
+        }
+        else if (n == 0) {
+            ERROR("TcpConnection::sendfile() file shorter than %lu bytes", len);
+            faultError = true;
+        }
+        else {
+            lastWrite_ = loop_->now();
+            if (offset == end && callbacks_->writeComplete) {
+                queueWriteComplete();
+            }
+        }
+    }
+    if (!faultError && offset < end) {
+        fd = ::dup(fd);
+        if (fd == -1) {
+            SYSERR("TcpConnection::dup()");
+            return;
+        }
+        outputBuffer_.appendFile(fd, offset, static_cast<size_t>(end - offset));
+        outputQueued();
+    }
+}
+
+void TcpConnection::outputQueued()
+{
+    // file regions count as pending output too
+    size_t newLen = outputBuffer_.readableBytes();
+    if (!aboveHighMark_ && highWaterMark_ > 0 && newLen >= highWaterMark_) {
+        aboveHighMark_ = true;
+        if (callbacks_->highWaterMark)
+            loop_->queueInLoop([ref = localPtr(), newLen]()
+                               { ref->callbacks_->highWaterMark(ref->self_, newLen); });
+    }
+    if (flowHighMark_ > 0 && newLen >= flowHighMark_)
+        throttleSource(true);
+    if (channel_.isWriting())
+        return;
+    // the poller submits the writes of an iteration with its next wait
+    if (deferredFlush_ && !channel_.completionIo()) {
+        if (!flushQueued_) {
+            flushQueued_ = true;
+            loop_->queueAfterEvents([ref = localPtr()](){ ref->flushInLoop(); });
+        }
+    }
+    else startWriting();
+}
+
+void TcpConnection::startWriting()
+{
+    // write timeout counts from the moment output gets stuck
+    lastWrite_ = loop_->now();
+    channel_.enableWrite();
+    if (writeTimeout_ > Nanosecond::zero())
+        scheduleTimeout();
+}
+
+void TcpConnection::setDeferredFlush(bool on)
+{
+    loop_->assertInLoopThread();
+    deferredFlush_ = on;
+    if (!on)
+        flushInLoop();
+}
+
+void TcpConnection::flush()
+{
+    loop_->runInLoop(std::bind(
+            &TcpConnection::flushInLoop, shared_from_this()));
+}
+
+void TcpConnection::flushInLoop()
+{
+    loop_->assertInLoopThread();
+    flushQueued_ = false;
+    // handleWrite() is on it
+    if (state_ == kDisconnected || channel_.isWriting() ||
+        outputBuffer_.readableBytes() == 0)
+        return;
+    if (channel_.completionIo()) {
+        startWriting();
+        return;
+    }
+
+    int savedErrno;
+    ssize_t n = outputBuffer_.writeFd(sockfd_, &savedErrno);
+    if (n == -1) {
+        if (savedErrno != EAGAIN) {
+            errno = savedErrno;
+            SYSERR("TcpConnection::flushInLoop()");
+            if (errno == EPIPE || errno == ECONNRESET) {
+                outputBuffer_.retrieveAll();
+                outputWritten();
+                return;
+            }
+        }
+    }
+    else lastWrite_ = loop_->now();
+    outputWritten();
+
+    if (outputBuffer_.readableBytes() > 0) {
+        // leave the rest to handleWrite()
+        startWriting();
+    }
+    else {
+        if (state_ == kDisconnecting)
+            shutdownInLoop();
+        if (callbacks_->writeComplete) {
+            queueWriteComplete();
+        }
+    }
 }
 
 void TcpConnection::send(Buffer& buffer)
+{
+    if (state_ != kConnected) {
+        WARN("TcpConnection::send() not connected, give up send");
+        return;
+    }
+    if (loop_->isInLoopThread()) {
+        sendInLoop(buffer.peek(), buffer.readableBytes());
+        buffer.retrieveAll();
+    }
+    else queueOutput(new OutputNode(buffer.retrieveAllAsString()));
+}
+
+void TcpConnection::send(Buffer&& buffer)
 {
     if (state_ != kConnected) {
         WARN("TcpConnection::send() not connected, give up send");
@@ -170,12 +446,100 @@ void TcpConnection::send(Buffer& buffer)
         buffer.retrieveAll();
     }
     else {
-        loop_->queueInLoop(
-                [ptr = shared_from_this(), str = buffer.retrieveAllAsString()]()
-                { ptr->sendInLoop(str); });
+        auto node = new OutputNode();
+        node->buffer.swap(buffer);
+        queueOutput(node);
+    }
+}
+
+void TcpConnection::queueOutput(OutputNode* node)
+{
+    pendingOutput_.push(node);
+    // only the first send of a batch queues a flush task
+    if (!flushPending_.exchange(true)) {
+        loop_->queueInLoop(std::bind(
+                &TcpConnection::flushPendingOutput, shared_from_this()));
     }
 }
 
+void TcpConnection::flushPendingOutput()
+{
+    loop_->assertInLoopThread();
+    // clear the flag before draining, like EventLoop::doPendingTasks()
+    flushPending_.store(false);
+    std::vector<OutputNode*> nodes;
+    while (OutputNode* node = pendingOutput_.pop())
+        nodes.push_back(node);
+
+    // bytes in memory, empty for a file region
+    auto bytesOf = [](const OutputNode* node) {
+        if (node->payload != nullptr)
+            return std::string_view(node->payload->data(), node->payload->size());
+        return node->data.empty()
+               ? std::string_view(node->buffer.peek(), node->buffer.readableBytes())
+               : std::string_view(node->data);
+    };
+
+    if (state_ == kDisconnected) {
+        WARN("TcpConnection::flushPendingOutput() disconnected, give up send");
+    }
+    else {
+        // gather the batch up to the first file region into one writev()
+        size_t written = 0;
+        bool wrote = false;
+        bool faultError = false;
+        if (!channel_.completionIo() && !channel_.isWriting() &&
+            outputBuffer_.readableBytes() == 0) {
+            std::vector<struct iovec> vec;
+            for (OutputNode* node: nodes) {
+                if (node->fd != -1 || vec.size() == IOV_MAX)
+                    break;
+                std::string_view bytes = bytesOf(node);
+                if (!bytes.empty())
+                    vec.push_back({const_cast<char*>(bytes.data()), bytes.size()});
+            }
+            ssize_t n = vec.empty() ? 0 : ::writev(sockfd_, vec.data(), static_cast<int>(vec.size()));
+            if (n == -1) {
+                if (errno != EAGAIN) {
+                    SYSERR("TcpConnection::writev()");
+                    if (errno == EPIPE || errno == ECONNRESET)
+                        faultError = true;
+                }
+            }
+            else {
+                if (n > 0)
+                    lastWrite_ = loop_->now();
+                written = static_cast<size_t>(n);
+                wrote = true;
+            }
+        }
+        if (!faultError) {
+            size_t oldLen = outputBuffer_.readableBytes();
+            for (OutputNode* node: nodes) {
+                if (node->fd != -1) {
+                    outputBuffer_.appendFile(node->fd, node->offset, node->fileLen);
+                    node->fd = -1;
+                    continue;
+                }
+                std::string_view bytes = bytesOf(node);
+                size_t skip = std::min(written, bytes.size());
+                written -= skip;
+                // a payload is still referenced rather than copied
+                if (node->payload != nullptr)
+                    outputBuffer_.append(node->payload, skip);
+                else
+                    outputBuffer_.append(bytes.substr(skip));
+            }
+            if (outputBuffer_.readableBytes() > oldLen)
+                outputQueued();
+            else if (wrote && callbacks_->writeComplete)
+                queueWriteComplete();
+        }
+    }
+    for (OutputNode* node: nodes)
+        delete node;
+}
+
 void TcpConnection::shutdown()
 {
     assert(state_ <= kDisconnecting);
@@ -192,7 +556,9 @@ void TcpConnection::shutdown()
 void TcpConnection::shutdownInLoop()
 {
     loop_->assertInLoopThread();
-    if (state_ != kDisconnected && !channel_.isWriting()) {
+    // flushInLoop() or handleWrite() shuts down once output drains
+    if (state_ != kDisconnected && !channel_.isWriting() &&
+        outputBuffer_.readableBytes() == 0) {
         if (::shutdown(sockfd_, SHUT_WR) == -1)
             SYSERR("TcpConnection:shutdown()");
     }
@@ -218,20 +584,184 @@ void TcpConnection::forceCloseInLoop()
 
 void TcpConnection::stopRead()
 {
-    loop_->runInLoop([this]() {
-        if (channel_.isReading())
-            channel_.disableRead();
+    loop_->runInLoop([ptr = shared_from_this()]() {
+        ptr->readStopped_ = true;
+        ptr->updateReading();
     });
 }
 
 void TcpConnection::startRead()
 {
-    loop_->runInLoop([this]() {
-        if (!channel_.isReading())
-            channel_.enableRead();
+    loop_->runInLoop([ptr = shared_from_this()]() {
+        ptr->readStopped_ = false;
+        ptr->updateReading();
     });
 }
 
+void TcpConnection::setFlowControl(size_t highMark, size_t lowMark,
+                                   const TcpConnectionPtr& source)
+{
+    loop_->assertInLoopThread();
+    assert(highMark == 0 || lowMark < highMark);
+    // let the old source go before switching
+    throttleSource(false);
+    flowHighMark_ = highMark;
+    flowLowMark_ = lowMark;
+    if (source != nullptr)
+        flowSource_ = source;
+    else
+        flowSource_ = weak_from_this();
+    if (highMark > 0 && outputBuffer_.readableBytes() >= highMark)
+        throttleSource(true);
+}
+
+void TcpConnection::outputWritten()
+{
+    size_t len = outputBuffer_.readableBytes();
+    if (aboveHighMark_ && len <= lowWaterMark_) {
+        aboveHighMark_ = false;
+        if (callbacks_->lowWaterMark)
+            loop_->queueInLoop([ref = localPtr(), len]()
+                               { ref->callbacks_->lowWaterMark(ref->self_, len); });
+    }
+    // throttling_ is only set by flow control
+    if (throttling_ && len <= flowLowMark_)
+        throttleSource(false);
+}
+
+void TcpConnection::throttleSource(bool on)
+{
+    if (throttling_ == on)
+        return;
+    throttling_ = on;
+    TcpConnectionPtr source = flowSource_.lock();
+    if (source == nullptr)
+        return;
+    // the source may live in another loop
+    if (source.get() == this)
+        throttleReadInLoop(on);
+    else {
+        source->loop_->runInLoop([source, on]()
+                                 { source->throttleReadInLoop(on); });
+    }
+}
+
+void TcpConnection::throttleReadInLoop(bool on)
+{
+    loop_->assertInLoopThread();
+    readThrottles_ += on ? 1 : -1;
+    assert(readThrottles_ >= 0);
+    updateReading();
+}
+
+void TcpConnection::updateReading()
+{
+    // connectEstablished() does it for a new connection
+    if (state_ == kConnecting || state_ == kDisconnected)
+        return;
+    bool on = !readStopped_ && readThrottles_ == 0;
+    if (on && !channel_.isReading()) {
+        // an edge reported while reading was off is gone
+        bool resume = channel_.isEdgeTriggered() && channel_.polling;
+        channel_.enableRead();
+        if (resume)
+            loop_->queueInLoop([ref = localPtr()](){ ref->resumeRead(); });
+    }
+    else if (!on && channel_.isReading())
+        channel_.disableRead();
+}
+
+void TcpConnection::setEdgeTriggered(bool on)
+{
+    loop_->assertInLoopThread();
+    // completions are reported once anyway
+    if (!channel_.completionIo())
+        channel_.setEdgeTriggered(on);
+}
+
+void TcpConnection::setReadBudget(size_t bytes)
+{
+    loop_->assertInLoopThread();
+    readBudget_ = bytes;
+}
+
+void TcpConnection::setIdleTimeout(Nanosecond timeout)
+{
+    loop_->assertInLoopThread();
+    idleTimeout_ = timeout;
+    scheduleTimeout();
+}
+
+void TcpConnection::setReadTimeout(Nanosecond timeout)
+{
+    loop_->assertInLoopThread();
+    readTimeout_ = timeout;
+    scheduleTimeout();
+}
+
+void TcpConnection::setWriteTimeout(Nanosecond timeout)
+{
+    loop_->assertInLoopThread();
+    writeTimeout_ = timeout;
+    scheduleTimeout();
+}
+
+Timestamp TcpConnection::nextDeadline() const
+{
+    Timestamp deadline = Timestamp::max();
+    if (idleTimeout_ > Nanosecond::zero())
+        deadline = std::min(deadline, std::max(lastRead_, lastWrite_) + idleTimeout_);
+    if (readTimeout_ > Nanosecond::zero())
+        deadline = std::min(deadline, lastRead_ + readTimeout_);
+    if (writeTimeout_ > Nanosecond::zero() && channel_.isWriting())
+        deadline = std::min(deadline, lastWrite_ + writeTimeout_);
+    return deadline;
+}
+
+void TcpConnection::scheduleTimeout()
+{
+    if (state_ != kConnected && state_ != kDisconnecting)
+        return;
+    Timestamp deadline = nextDeadline();
+    if (deadline == Timestamp::max())
+        return;
+    // a pending timer firing no later than the deadline will re-arm itself
+    if (timeoutTimer_) {
+        if (timeoutTimerWhen_ <= deadline)
+            return;
+        if (loop_->resetTimer(timeoutTimer_, deadline)) {
+            timeoutTimerWhen_ = deadline;
+            return;
+        }
+    }
+    timeoutTimerWhen_ = deadline;
+    timeoutTimer_ = loop_->runAt(deadline, [this](){handleTimeout();});
+}
+
+void TcpConnection::queueWriteComplete()
+{
+    // user may send data in writeComplete callback,
+    // queueInLoop can break the chain
+    loop_->queueInLoop([ref = localPtr()]()
+                       { ref->callbacks_->writeComplete(ref->self_); });
+}
+
+void TcpConnection::handleTimeout()
+{
+    loop_->assertInLoopThread();
+    // one shot timer, TimerQueue recycles it
+    timeoutTimer_ = TimerId();
+    Timestamp deadline = nextDeadline();
+    if (deadline == Timestamp::max())
+        return;
+    if (loop_->now() < deadline) {
+        scheduleTimeout();
+        return;
+    }
+    INFO("connection %s timeout, force close", name().c_str());
+    forceClose();
+}
+
 int TcpConnection::stateAtomicGetAndSet(int newState)
 {
     return __atomic_exchange_n(&state_, newState, __ATOMIC_SEQ_CST);
@@ -241,17 +771,67 @@ void TcpConnection::handleRead()
 {
     loop_->assertInLoopThread();
     assert(state_ != kDisconnected);
+    if (!channel_.isEdgeTriggered()) {
+        // poller reports the rest in next iteration
+        ssize_t n = readSocket(readBudget_ > 0 ? readBudget_ : SIZE_MAX);
+        if (readBudget_ > 0 && n == static_cast<ssize_t>(readBudget_))
+            readBudgetHits_++;
+        return;
+    }
+    // no more report until EAGAIN
+    size_t budget = readBudget_ > 0 ? readBudget_ : kIoBudget;
+    size_t total = 0;
+    while (channel_.isReading()) {
+        ssize_t n = readSocket(budget - total);
+        if (n <= 0 || state_ == kDisconnected)
+            return;
+        total += static_cast<size_t>(n);
+        if (total >= budget) {
+            readBudgetHits_++;
+            loop_->queueInLoop([ref = localPtr()](){ ref->resumeRead(); });
+            return;
+        }
+    }
+}
+
+void TcpConnection::resumeRead()
+{
+    if (state_ != kDisconnected && channel_.isReading())
+        handleRead();
+}
+
+ssize_t TcpConnection::readSocket(size_t maxBytes)
+{
+    // a connection with nothing buffered reads into the loop's buffer
+    bool shared = loop_->sharedReceiveBuffer() &&
+                  inputBuffer_.readableBytes() == 0;
+    Buffer& buffer = shared ? loop_->receiveBuffer() : inputBuffer_;
     int savedErrno;
-    ssize_t n = inputBuffer_.readFd(sockfd_, &savedErrno);
+    ssize_t n = buffer.readFd(sockfd_, &savedErrno, maxBytes);
     if (n == -1) {
-        errno = savedErrno;
-        SYSERR("TcpConnection::read()");
-        handleError();
+        if (savedErrno != EAGAIN) {
+            errno = savedErrno;
+            SYSERR("TcpConnection::read()");
+            handleError();
+        }
     }
     else if (n == 0)
         handleClose();
-    else
-        messageCallback_(shared_from_this(), inputBuffer_);
+    else {
+        lastRead_ = loop_->now();
+        callbacks_->message(self_, buffer);
+        if (!loop_->sharedReceiveBuffer())
+            return n;
+        // keep the incomplete message, give back drained storage
+        if (shared && buffer.readableBytes() > 0) {
+            loop_->bufferPool()->get(inputBuffer_);
+            inputBuffer_.append(buffer.peek(), buffer.readableBytes());
+            buffer.retrieveAll();
+        }
+        else if (!shared && inputBuffer_.readableBytes() == 0)
+            loop_->bufferPool()->put(inputBuffer_);
+    }
+    return n;
 }
 
 void TcpConnection::handleWrite()
@@ -263,22 +843,102 @@ void TcpConnection::handleWrite()
     }
     assert(outputBuffer_.readableBytes() > 0);
     assert(channel_.isWriting());
-    ssize_t n = ::write(sockfd_, outputBuffer_.peek(), outputBuffer_.readableBytes());
-    if (n == -1) {
-        SYSERR("TcpConnection::write()");
+    // edge-triggered mode writes until EAGAIN
+    size_t total = 0;
+    for (;;) {
+        int savedErrno;
+        ssize_t n = outputBuffer_.writeFd(sockfd_, &savedErrno);
+        if (n == -1) {
+            if (savedErrno != EAGAIN) {
+                errno = savedErrno;
+                SYSERR("TcpConnection::write()");
+            }
+            break;
+        }
+        lastWrite_ = loop_->now();
+        total += static_cast<size_t>(n);
+        if (!channel_.isEdgeTriggered() || outputBuffer_.readableBytes() == 0)
+            break;
+        if (total >= kIoBudget) {
+            loop_->queueInLoop([ref = localPtr()](){ ref->resumeWrite(); });
+            break;
+        }
+    }
+    writeFinished();
+}
+
+void TcpConnection::writeFinished()
+{
+    outputWritten();
+    // a broken file region is dropped with an error
+    if (outputBuffer_.readableBytes() == 0) {
+        channel_.disableWrite();
+        if (state_ == kDisconnecting)
+            shutdownInLoop();
+        if (callbacks_->writeComplete) {
+            queueWriteComplete();
+        }
+    }
+}
+
+struct iovec TcpConnection::readBuffer()
+{
+    if (state_ == kDisconnected)
+        return {nullptr, 0};
+    size_t len = readBudget_ > 0 ? readBudget_ : kRingReadSize;
+    inputBuffer_.ensureWritableBytes(len);
+    return {inputBuffer_.beginWrite(), len};
+}
+
+void TcpConnection::handleReadDone(int result)
+{
+    loop_->assertInLoopThread();
+    if (state_ == kDisconnected)
+        return;
+    if (result > 0) {
+        auto n = static_cast<size_t>(result);
+        inputBuffer_.hasWritten(n);
+        if (readBudget_ > 0 && n == readBudget_)
+            readBudgetHits_++;
+        lastRead_ = loop_->now();
+        callbacks_->message(self_, inputBuffer_);
     }
     else {
-        outputBuffer_.retrieve(static_cast<size_t>(n));
-        if (outputBuffer_.readableBytes() == 0) {
-            channel_.disableWrite();
-            if (state_ == kDisconnecting)
-                shutdownInLoop();
-            if (writeCompleteCallback_) {
-                loop_->queueInLoop(std::bind(
-                        writeCompleteCallback_, shared_from_this()));
-            }
+        // no more completion tells about an error
+        if (result < 0) {
+            errno = -result;
+            SYSERR("TcpConnection::read()");
         }
+        handleClose();
+    }
+}
+
+int TcpConnection::writeBuffers(struct iovec* vec, int maxVec)
+{
+    return outputBuffer_.peekIovecs(vec, maxVec);
+}
+
+void TcpConnection::handleWriteDone(int result)
+{
+    loop_->assertInLoopThread();
+    if (state_ == kDisconnected)
+        return;
+    if (result < 0) {
+        errno = -result;
+        SYSERR("TcpConnection::write()");
+        outputBuffer_.retrieveAll();
+    }
+    else {
+        lastWrite_ = loop_->now();
+        outputBuffer_.retrieve(static_cast<size_t>(result));
     }
+    writeFinished();
+}
+
+void TcpConnection::resumeWrite()
+{
+    if (state_ != kDisconnected && channel_.isWriting())
+        handleWrite();
 }
 
 void TcpConnection::handleClose()
@@ -286,9 +946,21 @@ void TcpConnection::handleClose()
     loop_->assertInLoopThread();
     assert(state_ == kConnected ||
            state_ == kDisconnecting);
+    // self_ stays until the events of this iteration are handled
+    LocalConnectionPtr ref = localPtr();
     state_ = kDisconnected;
+    loop_->connectionClosed();
+    // cancels the IO in flight on the buffers
     loop_->removeChannel(&channel_);
-    closeCallback_(shared_from_this());
+    // give slabs back while still in loop thread
+    outputBuffer_.retrieveAll();
+    // a relay source must not stay stopped by a closed connection
+    throttleSource(false);
+    loop_->cancelTimer(timeoutTimer_);
+    timeoutTimer_ = TimerId();
+    callbacks_->close(self_);
+    // messageCallback may be using the input buffer
+    loop_->queueInLoop([ref = std::move(ref)](){ ref->releaseInput(); });
 }
 
 void TcpConnection::handleError()
@@ -6,20 +6,30 @@
 #define TINYEV_TCPCONNECTION_H
 
 #include <any>
+#include <atomic>
+#include <unistd.h>
 
 #include <tinyev/noncopyable.h>
 #include <tinyev/Buffer.h>
+#include <tinyev/ChainBuffer.h>
 #include <tinyev/Callbacks.h>
 #include <tinyev/Channel.h>
 #include <tinyev/InetAddress.h>
+#include <tinyev/MpscQueue.h>
+#include <tinyev/Timer.h>
 
 namespace ev
 {
 
 class EventLoop;
+class LocalConnectionPtr;
 
+// an established connection refers to itself until it is closed, so
+// event handlers pass that reference to callbacks instead of locking a
+// weak_ptr and bumping an atomic count per event
 class TcpConnection: noncopyable,
-                     public std::enable_shared_from_this<TcpConnection>
+                     public std::enable_shared_from_this<TcpConnection>,
+                     private ChannelHandler
 {
 public:
     TcpConnection(EventLoop* loop, int sockfd,
@@ -27,23 +37,84 @@ public:
                   const InetAddress& peer);
     ~TcpConnection();
 
+    // callbacks of this connection only, the shared ones are copied
     void setMessageCallback(const MessageCallback& cb)
-    { messageCallback_ = cb; }
+    { unshare(callbacks_).message = cb; }
     void setWriteCompleteCallback(const WriteCompleteCallback& cb)
-    { writeCompleteCallback_ = cb; }
+    { unshare(callbacks_).writeComplete = cb; }
+    // output crosses up to the high water mark, it does not fire
+    // again until output drains to the low water mark (0 by default)
     void setHighWaterMarkCallback(const HighWaterMarkCallback& cb, size_t mark)
-    { highWaterMarkCallback_ = cb; highWaterMark_ = mark; }
+    { unshare(callbacks_).highWaterMark = cb; highWaterMark_ = mark; }
+    // output drains to the low water mark after the high one was hit
+    void setLowWaterMarkCallback(const LowWaterMarkCallback& cb, size_t mark)
+    { unshare(callbacks_).lowWaterMark = cb; lowWaterMark_ = mark; }
+
+    // stop reading source while output is between highMark and lowMark,
+    // zero highMark disables it. the marks are independent of the water
+    // mark callbacks, both may be set on one connection. source is this
+    // connection by default, a relay passes the connection whose input
+    // it sends here. not thread safe, call it in connection callback
+    void setFlowControl(size_t highMark, size_t lowMark,
+                        const TcpConnectionPtr& source = nullptr);
+
+    // force close the connection when it times out, zero disables it.
+    // not thread safe, call them in connection callback.
+    // idle: nothing is read or written
+    void setIdleTimeout(Nanosecond timeout);
+    // read: nothing is read
+    void setReadTimeout(Nanosecond timeout);
+    // write: pending output makes no progress
+    void setWriteTimeout(Nanosecond timeout);
+
+    // batch the sends of a loop iteration into one writev() after all
+    // events are handled. not thread safe, call it in connection callback
+    void setDeferredFlush(bool on);
+    // write out what deferred flush mode is holding now, thread safe
+    void flush();
+
+    // EPOLLET: handlers read and write until EAGAIN, a connection over
+    // kIoBudget bytes goes on after the other ready ones. ignored when
+    // the poller does the IO. not thread safe, call it in connection callback
+    void setEdgeTriggered(bool on);
+
+    // bytes read per loop iteration, the rest waits until the other
+    // ready channels are handled. zero means one read of up to 128KB
+    // (kIoBudget in edge-triggered mode). not thread safe
+    void setReadBudget(size_t bytes);
+    // times the read budget ran out, not thread safe
+    uint64_t readBudgetHits() const
+    { return readBudgetHits_; }
 
     // internal use
     void setCloseCallBack(const CloseCallback& cb)
-    { closeCallback_ = cb; }
+    { unshare(callbacks_).close = cb; }
+    // TcpServerSingle and TcpClient, shared by their connections
+    void setCallbacks(const ConnectionCallbacksPtr& callbacks)
+    { callbacks_ = callbacks; }
+    // TcpServerSingle
+    void setId(ConnectionId id)
+    { id_ = id; }
 
     // TcpServerSingle
     void connectEstablished();
+    // the owner goes away with the connection still open, drop it
+    // without closeCallback. must be called in loop thread
+    void connectDestroyed();
+
+    // a reference with a loop-local, non-atomic count, e.g. kept by
+    // tasks and timers of the loop. must be used in loop thread,
+    // TcpConnectionPtr is the one to hand to other threads
+    LocalConnectionPtr localPtr();
 
     bool connected() const;
     bool disconnected() const;
 
+    // given by the server that accepted it, 0 for a client connection.
+    // other threads send by it through TcpServer without holding this
+    ConnectionId id() const
+    { return id_; }
+
     const InetAddress& local() const
     { return local_; }
     const InetAddress& peer() const
@@ -59,48 +130,197 @@ public:
     std::any& getContext()
     { return context_; }
 
-    // I/O operations are thread safe
+    // I/O operations are thread safe.
+    // sends from other threads are queued and written by the loop
+    // with one writev() per iteration
     void send(std::string_view data);
+    void send(const char* data)
+    { send(std::string_view(data)); }
     void send(const char* data, size_t len);
+    void send(std::string&& data);
     void send(Buffer& buffer);
+    void send(Buffer&& buffer);
+    // the payload is referenced until written, never copied
+    void send(const PayloadPtr& payload);
+    // [offset, offset + len) of fd by sendfile(2), in order with
+    // other output. fd is dup()ed if needed, caller may close it
+    void sendFile(int fd, off_t offset, size_t len);
     void shutdown();
     void forceClose();
 
+    // reading is on when it is started and no flow control holds it
     void stopRead();
     void startRead();
     bool isReading() // not thread safe
     { return channel_.isReading(); };
 
     const Buffer& inputBuffer() const { return inputBuffer_; }
-    const Buffer& outputBuffer() const { return outputBuffer_; }
+    const ChainBuffer& outputBuffer() const { return outputBuffer_; }
 
 private:
-    void handleRead();
-    void handleWrite();
-    void handleClose();
-    void handleError();
+    // bytes read or written per loop iteration in edge-triggered mode
+    static const size_t kIoBudget = 256 * 1024;
+    // bytes of one read submitted to the poller
+    static const size_t kRingReadSize = 16 * 1024;
+
+    // one cross-thread send: bytes, a payload or a file region
+    struct OutputNode
+    {
+        explicit
+        OutputNode(std::string bytes = std::string())
+                : next(nullptr), data(std::move(bytes)), buffer(0)
+        {}
+
+        std::atomic<OutputNode*> next;
+        std::string data;
+        Buffer buffer; // the stub of pendingOutput_ allocates nothing
+        PayloadPtr payload;
+        int fd = -1;               // a file region, owned by the node
+        off_t offset = 0;
+        size_t fileLen = 0;
+
+        ~OutputNode()
+        { if (fd != -1) ::close(fd); }
+    };
+
+    void handleRead() override;
+    ssize_t readSocket(size_t maxBytes);
+    void resumeRead();
+    void handleWrite() override;
+    void resumeWrite();
+    void handleClose() override;
+    void handleError() override;
+    // the poller does the IO, see Channel::setIoMode()
+    struct iovec readBuffer() override;
+    void handleReadDone(int result) override;
+    int writeBuffers(struct iovec* vec, int maxVec) override;
+    void handleWriteDone(int result) override;
+    void writeFinished();
 
     void sendInLoop(const char* data, size_t len);
-    void sendInLoop(const std::string& message);
+    void sendInLoop(const PayloadPtr& payload);
+    void sendInLoop(const char* data, size_t len, const PayloadPtr& payload);
+    void sendFileInLoop(int fd, off_t offset, size_t len);
+    void outputQueued();
+    void startWriting();
+    void flushInLoop();
+    void queueOutput(OutputNode* node);
+    void flushPendingOutput();
     void shutdownInLoop();
     void forceCloseInLoop();
 
+    void outputWritten();
+    void queueWriteComplete();
+    // back to the loop's pool, in loop thread
+    void releaseInput();
+    void throttleSource(bool on);
+    void throttleReadInLoop(bool on);
+    void updateReading();
+
     int stateAtomicGetAndSet(int newState);
 
+    Timestamp nextDeadline() const;
+    void scheduleTimeout();
+    void handleTimeout();
+
+    // hot: used by every read and write
     EventLoop* loop_;
-    const int sockfd_;
     Channel channel_;
+    const int sockfd_;
     int state_;
+    int localRefs_;
+    bool aboveHighMark_;  // high water mark hit, low not yet
+    bool deferredFlush_;
+    bool flushQueued_;    // flushInLoop() is queued after events
+    size_t readBudget_;
+    size_t highWaterMark_;
+    size_t flowHighMark_; // zero without flow control
+    Buffer inputBuffer_;
+    ChainBuffer outputBuffer_;
+    ConnectionCallbacksPtr callbacks_;
+    // from connectEstablished() until closed and no LocalConnectionPtr
+    TcpConnectionPtr self_;
+    // refreshing a deadline is just a store to lastRead_/lastWrite_,
+    // the timer is re-armed lazily when it fires before the deadline
+    Timestamp lastRead_;
+    Timestamp lastWrite_;
+
+    // cold: set up once or used by rare events
+    bool throttling_;     // flowSource_ is stopped by us
+    bool readStopped_;    // stopRead() by user
+    int readThrottles_;   // flow controls holding our reading
+    size_t lowWaterMark_;
+    size_t flowLowMark_;
+    std::weak_ptr<TcpConnection> flowSource_;
+    Nanosecond idleTimeout_;
+    Nanosecond readTimeout_;
+    Nanosecond writeTimeout_;
+    TimerId timeoutTimer_;
+    Timestamp timeoutTimerWhen_;
+    uint64_t readBudgetHits_;
+    ConnectionId id_;
     InetAddress local_;
     InetAddress peer_;
-    Buffer inputBuffer_;
-    Buffer outputBuffer_;
-    size_t highWaterMark_;
     std::any context_;
-    MessageCallback messageCallback_;
-    WriteCompleteCallback writeCompleteCallback_;
-    HighWaterMarkCallback highWaterMarkCallback_;
-    CloseCallback closeCallback_;
+
+    // cross-thread sends, flushed by one task per batch.
+    // last, other threads write here
+    MpscQueue<OutputNode> pendingOutput_;
+    std::atomic_bool flushPending_;
+
+    friend class LocalConnectionPtr;
+    void releaseSelf();
+};
+
+class LocalConnectionPtr
+{
+public:
+    LocalConnectionPtr()
+            : conn_(nullptr)
+    {}
+
+    explicit
+    LocalConnectionPtr(TcpConnection* conn)
+            : conn_(conn)
+    { if (conn_ != nullptr) conn_->localRefs_++; }
+
+    LocalConnectionPtr(const LocalConnectionPtr& rhs)
+            : LocalConnectionPtr(rhs.conn_)
+    {}
+
+    LocalConnectionPtr(LocalConnectionPtr&& rhs) noexcept
+            : conn_(rhs.conn_)
+    { rhs.conn_ = nullptr; }
+
+    LocalConnectionPtr& operator=(LocalConnectionPtr rhs) noexcept
+    {
+        std::swap(conn_, rhs.conn_);
+        return *this;
+    }
+
+    ~LocalConnectionPtr()
+    {
+        // the last one of a closed connection lets it go
+        if (conn_ != nullptr && --conn_->localRefs_ == 0 &&
+            conn_->disconnected())
+            conn_->releaseSelf();
+    }
+
+    TcpConnection* get() const
+    { return conn_; }
+    TcpConnection* operator->() const
+    { return conn_; }
+    TcpConnection& operator*() const
+    { return *conn_; }
+    explicit operator bool() const
+    { return conn_ != nullptr; }
+
+    // a reference for other threads
+    TcpConnectionPtr shared() const
+    { return conn_ == nullptr ? nullptr : conn_->shared_from_this(); }
+
+private:
+    TcpConnection* conn_;
 };
 
 }
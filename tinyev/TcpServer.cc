@@ -6,39 +6,59 @@
 #include <tinyev/TcpConnection.h>
 #include <tinyev/TcpServerSingle.h>
 #include <tinyev/EventLoop.h>
+#include <tinyev/EventLoopThreadPool.h>
+#include <tinyev/CountDownLatch.h>
 #include <tinyev/TcpServer.h>
 
 using namespace ev;
 
 TcpServer::TcpServer(EventLoop* loop, const InetAddress& local)
         : baseLoop_(loop),
+          ownsThreadPool_(false),
           numThreads_(1),
           started_(false),
           local_(local),
           threadInitCallback_(defaultThreadInitCallback),
           connectionCallback_(defaultConnectionCallback),
-          messageCallback_(defaultMessageCallback)
+          messageCallback_(defaultMessageCallback),
+          idleTimeout_(Nanosecond::zero()),
+          readTimeout_(Nanosecond::zero()),
+          writeTimeout_(Nanosecond::zero()),
+          sharedReceive_(false),
+          busyPollWindow_(Nanosecond::zero()),
+          socketBusyPoll_(Microsecond::zero()),
+          deferredFlush_(false),
+          highWaterMark_(0),
+          lowWaterMark_(0),
+          edgeTriggered_(false),
+          readBudget_(0)
 {
     INFO("create TcpServer() %s", local.toIpPort().c_str());
 }
 
 TcpServer::~TcpServer()
 {
-    for (auto& loop: eventLoops_)
-        if (loop != nullptr)
-            loop->quit();
-    for (auto& thread: threads_)
-        thread->join();
+    // connections of a server are destroyed in its loop thread,
+    // the pool may live on
+    size_t n = servers_.size() > 1 ? servers_.size() - 1 : 0;
+    CountDownLatch latch(static_cast<int>(n));
+    for (size_t i = 1; i < servers_.size(); ++i) {
+        TcpServerSingle* server = servers_[i].release();
+        server->loop()->runInLoop([server, &latch]() {
+            delete server;
+            latch.count();
+        });
+    }
+    latch.wait();
     TRACE("~TcpServer()");
 }
 
 void TcpServer::setNumThread(size_t n)
 {
     baseLoop_->assertInLoopThread();
-    assert(n > 0);
+    assert(n > 0 && n <= TcpServerSingle::kMaxLoops);
     assert(!started_);
     numThreads_ = n;
-    eventLoops_.resize(n);
 }
 
 void TcpServer::start()
@@ -51,47 +71,79 @@ void TcpServer::start()
 
 void TcpServer::startInLoop()
 {
+    // same IO backend as the base loop
+    if (threadPool_ == nullptr) {
+        threadPool_ = std::make_shared<EventLoopThreadPool>(
+                numThreads_ - 1, baseLoop_->pollerType());
+        ownsThreadPool_ = true;
+    }
+    assert(threadPool_->size() < TcpServerSingle::kMaxLoops);
+    numThreads_ = threadPool_->size() + 1;
+
     INFO("TcpServer::start() %s with %lu eventLoop thread(s)",
          local_.toIpPort().c_str(), numThreads_);
 
-    baseServer_ = std::make_unique<TcpServerSingle>(baseLoop_, local_);
-    baseServer_->setConnectionCallback(connectionCallback_);
-    baseServer_->setMessageCallback(messageCallback_);
-    baseServer_->setWriteCompleteCallback(writeCompleteCallback_);
-    threadInitCallback_(0);
-    baseServer_->start();
+    if (!threadPool_->started())
+        threadPool_->start([this](size_t index) {
+            threadInitCallback_(index + 1);
+        });
 
+    // servers_ is complete before start() returns in baseLoop thread,
+    // send() only reads it
+    servers_.resize(numThreads_);
+    CountDownLatch latch(static_cast<int>(numThreads_ - 1));
     for (size_t i = 1; i < numThreads_; ++i) {
-        auto thread = new std::thread(std::bind(
-                &TcpServer::runInThread, this, i));
-        {
-            std::unique_lock<std::mutex> lock(mutex_);
-            while (eventLoops_[i] == nullptr)
-                cond_.wait(lock);
-        }
-        threads_.emplace_back(thread);
+        threadPool_->getLoop(i - 1)->runInLoop([this, i, &latch]() {
+            startServer(i);
+            latch.count();
+        });
     }
+    threadInitCallback_(0);
+    startServer(0);
+    latch.wait();
+}
 
-
+void TcpServer::startServer(size_t index)
+{
+    EventLoop* loop = index == 0 ? baseLoop_ : threadPool_->getLoop(index - 1);
+    // the loops of a shared pool belong to whoever made it
+    if (index == 0 || ownsThreadPool_) {
+        if (sharedReceive_)
+            loop->setSharedReceiveBuffer(true);
+        if (busyPollWindow_ > Nanosecond::zero())
+            loop->setBusyPoll(busyPollWindow_, socketBusyPoll_);
+    }
+    servers_[index] = std::make_unique<TcpServerSingle>(loop, local_, index);
+    initServer(*servers_[index]);
+    servers_[index]->start();
 }
 
-void TcpServer::runInThread(size_t index)
+bool TcpServer::send(ConnectionId id, std::string data)
 {
-    EventLoop loop;
-    TcpServerSingle server(&loop, local_);
+    size_t index = TcpServerSingle::loopIndexOf(id);
+    if (id == 0 || index >= servers_.size())
+        return false;
+    TcpServerSingle* server = servers_[index].get();
+    if (server == nullptr)
+        return false;
+    EventLoop* loop = server->loop();
+    if (loop->isInLoopThread())
+        return server->send(id, data);
+    loop->queueInLoop([server, id, data = std::move(data)]()
+                      { server->send(id, data); });
+    return true;
+}
 
+void TcpServer::initServer(TcpServerSingle& server)
+{
     server.setConnectionCallback(connectionCallback_);
     server.setMessageCallback(messageCallback_);
     server.setWriteCompleteCallback(writeCompleteCallback_);
-
-    {
-        std::lock_guard<std::mutex> guard(mutex_);
-        eventLoops_[index] = &loop;
-        cond_.notify_one();
-    }
-
-    threadInitCallback_(index);
-    server.start();
-    loop.loop();
-    eventLoops_[index] = nullptr;
+    server.setIdleTimeout(idleTimeout_);
+    server.setReadTimeout(readTimeout_);
+    server.setWriteTimeout(writeTimeout_);
+    server.setDeferredFlush(deferredFlush_);
+    server.setFlowControl(highWaterMark_, lowWaterMark_);
+    server.setEdgeTriggered(edgeTriggered_);
+    server.setReadBudget(readBudget_);
 }
@@ -6,10 +6,7 @@
 #define TINYEV_TCPSERVER_H
 
 #include <vector>
-#include <thread>
-#include <mutex>
 #include <atomic>
-#include <condition_variable>
 
 #include <tinyev/TcpServerSingle.h>
 #include <tinyev/InetAddress.h>
@@ -19,7 +16,7 @@
 namespace ev
 {
 
-class EventLoopThread;
+class EventLoopThreadPool;
 class TcpServerSingle;
 class EventLoop;
 class InetAddress;
@@ -37,6 +34,16 @@ public:
     // except the baseLoop thread
     void start();
 
+    // accept on every loop of pool instead of (n - 1) own threads,
+    // e.g. a pool shared with other servers and clients. the pool is
+    // started here if it is not yet. its loops are left as they are,
+    // the shared receive buffer and busy poll settings of this server
+    // only apply to the base loop. must be called before start()
+    void setThreadPool(const std::shared_ptr<EventLoopThreadPool>& pool)
+    { threadPool_ = pool; }
+    const std::shared_ptr<EventLoopThreadPool>& threadPool() const
+    { return threadPool_; }
+
     void setThreadInitCallback(const ThreadInitCallback& cb)
     { threadInitCallback_ = cb; }
     void setConnectionCallback(const ConnectionCallback& cb)
@@ -45,29 +52,75 @@ public:
     { messageCallback_ = cb; }
     void setWriteCompleteCallback(const WriteCompleteCallback& cb)
     { writeCompleteCallback_ = cb; }
+    // force close connections that time out, zero disables it.
+    // must be called before start()
+    void setIdleTimeout(Nanosecond timeout)
+    { idleTimeout_ = timeout; }
+    void setReadTimeout(Nanosecond timeout)
+    { readTimeout_ = timeout; }
+    void setWriteTimeout(Nanosecond timeout)
+    { writeTimeout_ = timeout; }
+    // see EventLoop::setSharedReceiveBuffer(), applied to the base loop
+    // and the loops of the server's own threads, not to a pool given by
+    // setThreadPool(). must be called before start()
+    void setSharedReceiveBuffer(bool on)
+    { sharedReceive_ = on; }
+    // see EventLoop::setBusyPoll(), applied like the shared receive
+    // buffer. must be called before start()
+    void setBusyPoll(Nanosecond window,
+                     Microsecond socketBusyPoll = Microsecond::zero())
+    { busyPollWindow_ = window; socketBusyPoll_ = socketBusyPoll; }
+    // see TcpConnection::setDeferredFlush(), must be called before start()
+    void setDeferredFlush(bool on)
+    { deferredFlush_ = on; }
+    // see TcpConnection::setFlowControl(), every connection stops
+    // reading itself. must be called before start()
+    void setFlowControl(size_t highMark, size_t lowMark)
+    { highWaterMark_ = highMark; lowWaterMark_ = lowMark; }
+    // see TcpConnection::setEdgeTriggered(), the acceptors drain their
+    // queues too. must be called before start()
+    void setEdgeTriggered(bool on)
+    { edgeTriggered_ = on; }
+    // see TcpConnection::setReadBudget(), must be called before start()
+    void setReadBudget(size_t bytes)
+    { readBudget_ = bytes; }
+
+    // send to a connection by TcpConnection::id(), thread safe.
+    // the loop of the connection is found from the id and other threads
+    // queue the data to it, a closed or stale id is dropped there.
+    // false if the id is rejected right away
+    bool send(ConnectionId id, std::string data);
 
 private:
     void startInLoop();
-    void runInThread(size_t index);
+    void startServer(size_t index);
+    void initServer(TcpServerSingle& server);
 
-    typedef std::unique_ptr<std::thread> ThreadPtr;
-    typedef std::vector<ThreadPtr> ThreadPtrList;
     typedef std::unique_ptr<TcpServerSingle> TcpServerSinglePtr;
-    typedef std::vector<EventLoop*> EventLoopList;
+    typedef std::vector<TcpServerSinglePtr> TcpServerSingleList;
 
     EventLoop* baseLoop_;
-    TcpServerSinglePtr baseServer_;
-    ThreadPtrList threads_;
-    EventLoopList eventLoops_;
+    std::shared_ptr<EventLoopThreadPool> threadPool_;
+    bool ownsThreadPool_;  // not given by setThreadPool()
+    TcpServerSingleList servers_; // by loop index, base loop first
     size_t numThreads_;
     std::atomic_bool started_;
     InetAddress local_;
-    std::mutex mutex_;
-    std::condition_variable cond_;
     ThreadInitCallback threadInitCallback_;
     ConnectionCallback connectionCallback_;
     MessageCallback messageCallback_;
     WriteCompleteCallback writeCompleteCallback_;
+    Nanosecond idleTimeout_;
+    Nanosecond readTimeout_;
+    Nanosecond writeTimeout_;
+    bool sharedReceive_;
+    Nanosecond busyPollWindow_;
+    Microsecond socketBusyPoll_;
+    bool deferredFlush_;
+    size_t highWaterMark_;
+    size_t lowWaterMark_;
+    bool edgeTriggered_;
+    size_t readBudget_;
 };
 
 }
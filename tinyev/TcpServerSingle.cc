@@ -2,6 +2,8 @@
 // Created by frank on 17-9-1.
 //
 
+#include <unistd.h>
+
 #include "Logger.h"
 #include "TcpConnection.h"
 #include "EventLoop.h"
@@ -10,16 +12,44 @@
 
 using namespace ev;
 
-TcpServerSingle::TcpServerSingle(EventLoop* loop, const InetAddress& local)
+const size_t TcpServerSingle::kMaxLoops;
+const size_t TcpServerSingle::kMaxSlots;
+const uint32_t TcpServerSingle::kNoSlot;
+
+TcpServerSingle::TcpServerSingle(EventLoop* loop, const InetAddress& local,
+                                 size_t loopIndex)
         : loop_(loop),
-          acceptor_(loop, local)
+          loopIndex_(loopIndex),
+          acceptor_(loop, local),
+          freeSlot_(kNoSlot),
+          callbacks_(std::make_shared<ConnectionCallbacks>()),
+          idleTimeout_(Nanosecond::zero()),
+          readTimeout_(Nanosecond::zero()),
+          writeTimeout_(Nanosecond::zero()),
+          deferredFlush_(false),
+          highWaterMark_(0),
+          lowWaterMark_(0),
+          edgeTriggered_(false),
+          readBudget_(0)
 {
+    assert(loopIndex_ < kMaxLoops);
     acceptor_.setNewConnectionCallback(std::bind(
             &TcpServerSingle::newConnection, this, _1, _2, _3));
+    callbacks_->close = std::bind(
+            &TcpServerSingle::closeConnection, this, _1);
+}
+
+TcpServerSingle::~TcpServerSingle()
+{
+    // open connections refer to themselves
+    for (auto& slot: slots_)
+        if (slot.conn != nullptr)
+            slot.conn->connectDestroyed();
 }
 
 void TcpServerSingle::start()
 {
+    acceptor_.setEdgeTriggered(edgeTriggered_);
     acceptor_.listen();
 }
 
@@ -28,13 +58,35 @@ void TcpServerSingle::newConnection(int connfd,
                                     const InetAddress& peer)
 {
     loop_->assertInLoopThread();
-    auto conn = std::make_shared<TcpConnection>
-            (loop_, connfd, local, peer);
-    connections_.insert(conn);
-    conn->setMessageCallback(messageCallback_);
-    conn->setWriteCompleteCallback(writeCompleteCallback_);
-    conn->setCloseCallBack(std::bind(
-            &TcpServerSingle::closeConnection, this, _1));
+    uint32_t index = freeSlot_;
+    if (index == kNoSlot) {
+        if (slots_.size() == kMaxSlots) {
+            ERROR("TcpServerSingle::newConnection() %lu connections already",
+                  kMaxSlots);
+            ::close(connfd);
+            return;
+        }
+        index = static_cast<uint32_t>(slots_.size());
+        slots_.push_back({nullptr, 1, kNoSlot});
+    }
+    Slot& slot = slots_[index];
+    freeSlot_ = slot.nextFree;
+
+    auto conn = std::allocate_shared<TcpConnection>
+            (PoolAllocator<TcpConnection>(loop_->connectionPool()),
+             loop_, connfd, local, peer);
+    conn->setId(static_cast<ConnectionId>(loopIndex_) << 56 |
+                static_cast<ConnectionId>(slot.generation) << 24 | index);
+    slot.conn = conn;
+    conn->setCallbacks(callbacks_);
+    conn->setIdleTimeout(idleTimeout_);
+    conn->setReadTimeout(readTimeout_);
+    conn->setWriteTimeout(writeTimeout_);
+    conn->setDeferredFlush(deferredFlush_);
+    if (highWaterMark_ > 0)
+        conn->setFlowControl(highWaterMark_, lowWaterMark_);
+    conn->setEdgeTriggered(edgeTriggered_);
+    conn->setReadBudget(readBudget_);
     // enable and tie channel
     conn->connectEstablished();
     connectionCallback_(conn);
@@ -43,8 +95,42 @@ void TcpServerSingle::newConnection(int connfd,
 void TcpServerSingle::closeConnection(const TcpConnectionPtr& conn)
 {
     loop_->assertInLoopThread();
-    size_t ret = connections_.erase(conn);
-    assert(ret == 1);(void)ret;
+    auto index = static_cast<uint32_t>(conn->id() & (kMaxSlots - 1));
+    Slot& slot = slots_[index];
+    assert(slot.conn == conn);
+    slot.conn.reset();
+    // 0 is left out, no id is 0
+    if (++slot.generation == 0)
+        slot.generation = 1;
+    slot.nextFree = freeSlot_;
+    freeSlot_ = index;
     connectionCallback_(conn);
 }
 
+const TcpServerSingle::Slot* TcpServerSingle::slotOf(ConnectionId id) const
+{
+    size_t index = id & (kMaxSlots - 1);
+    if (loopIndexOf(id) != loopIndex_ || index >= slots_.size())
+        return nullptr;
+    const Slot& slot = slots_[index];
+    if (slot.generation != static_cast<uint32_t>(id >> 24) || slot.conn == nullptr)
+        return nullptr;
+    return &slot;
+}
+
+TcpConnection* TcpServerSingle::connection(ConnectionId id) const
+{
+    loop_->assertInLoopThread();
+    const Slot* slot = slotOf(id);
+    return slot == nullptr ? nullptr : slot->conn.get();
+}
+
+bool TcpServerSingle::send(ConnectionId id, std::string_view data)
+{
+    TcpConnection* conn = connection(id);
+    if (conn == nullptr)
+        return false;
+    conn->send(data);
+    return true;
+}
+
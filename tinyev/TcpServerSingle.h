@@ -5,10 +5,11 @@
 #ifndef TINYEV_TCPSERVERTHREAD_H
 #define TINYEV_TCPSERVERTHREAD_H
 
-#include <unordered_set>
+#include <vector>
 
 #include <tinyev/Callbacks.h>
 #include <tinyev/Acceptor.h>
+#include <tinyev/Timestamp.h>
 
 namespace ev
 {
@@ -17,30 +18,84 @@ class EventLoop;
 class TcpServerSingle : noncopyable
 {
 public:
-    TcpServerSingle(EventLoop *loop, const InetAddress &local);
+    // loopIndex goes into the ids of the connections, see TcpServer
+    TcpServerSingle(EventLoop *loop, const InetAddress &local, size_t loopIndex = 0);
+    ~TcpServerSingle();
+
+    // a connection id is [loop index:8][generation:32][slot:24].
+    // a slot is reused with the next generation, so a stale id fails
+    // the generation check
+    static const size_t kMaxLoops = 1 << 8;
+    static const size_t kMaxSlots = 1 << 24;
+    static size_t loopIndexOf(ConnectionId id)
+    { return static_cast<size_t>(id >> 56); }
+
+    EventLoop* loop() const
+    { return loop_; }
 
     void setConnectionCallback(const ConnectionCallback &cb)
     { connectionCallback_ = cb; }
     void setMessageCallback(const MessageCallback &cb)
-    { messageCallback_ = cb; }
+    { unshare(callbacks_).message = cb; }
     void setWriteCompleteCallback(const WriteCompleteCallback &cb)
-    { writeCompleteCallback_ = cb; }
+    { unshare(callbacks_).writeComplete = cb; }
+    // applied to every new connection, see TcpConnection
+    void setIdleTimeout(Nanosecond timeout)
+    { idleTimeout_ = timeout; }
+    void setReadTimeout(Nanosecond timeout)
+    { readTimeout_ = timeout; }
+    void setWriteTimeout(Nanosecond timeout)
+    { writeTimeout_ = timeout; }
+    void setDeferredFlush(bool on)
+    { deferredFlush_ = on; }
+    void setFlowControl(size_t highMark, size_t lowMark)
+    { highWaterMark_ = highMark; lowWaterMark_ = lowMark; }
+    // the acceptor too, must be called before start()
+    void setEdgeTriggered(bool on)
+    { edgeTriggered_ = on; }
+    void setReadBudget(size_t bytes)
+    { readBudget_ = bytes; }
 
     void start();
 
+    // O(1), nullptr for a closed or stale id. must be called in loop thread
+    TcpConnection* connection(ConnectionId id) const;
+    // false for a closed or stale id. must be called in loop thread
+    bool send(ConnectionId id, std::string_view data);
+
 private:
     void newConnection(int connfd, const InetAddress &local, const InetAddress &peer);
 
     void closeConnection(const TcpConnectionPtr &conn);
 
-    typedef std::unordered_set<TcpConnectionPtr> ConnectionSet;
+    struct Slot
+    {
+        TcpConnectionPtr conn;
+        uint32_t generation;
+        uint32_t nextFree;
+    };
+
+    static const uint32_t kNoSlot = UINT32_MAX;
+
+    const Slot* slotOf(ConnectionId id) const;
 
     EventLoop *loop_;
+    const size_t loopIndex_;
     Acceptor acceptor_;
-    ConnectionSet connections_;
+    // connections by slot, free slots are linked by nextFree
+    std::vector<Slot> slots_;
+    uint32_t freeSlot_;
     ConnectionCallback connectionCallback_;
-    MessageCallback messageCallback_;
-    WriteCompleteCallback writeCompleteCallback_;
+    // shared by the connections
+    ConnectionCallbacksPtr callbacks_;
+    Nanosecond idleTimeout_;
+    Nanosecond readTimeout_;
+    Nanosecond writeTimeout_;
+    bool deferredFlush_;
+    size_t highWaterMark_;
+    size_t lowWaterMark_;
+    bool edgeTriggered_;
+    size_t readBudget_;
 };
 
 }
@@ -27,7 +27,6 @@ public:
                const ThreadInitCallback& cb = nullptr);
     ~ThreadPool();
 
-    void runTask(const Task& task);
     void runTask(Task&& task);
     void stop();
     size_t numThreads() const
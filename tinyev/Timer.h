@@ -6,9 +6,10 @@
 #define TINYEV_TIMER_H
 
 #include <cassert>
+#include <cstdint>
 
+#include <tinyev/noncopyable.h>
 #include <tinyev/Callbacks.h>
-#include <tinyev/Channel.h>
 #include <tinyev/Timestamp.h>
 
 namespace ev
@@ -22,7 +23,12 @@ public:
               when_(when),
               interval_(interval),
               repeat_(interval_ > Nanosecond::zero()),
-              canceled_(false)
+              canceled_(false),
+              rearmed_(false),
+              bucket_(-1),
+              generation_(0),
+              prev_(nullptr),
+              next_(nullptr)
     {
     }
 
@@ -43,11 +49,45 @@ public:
     bool canceled() const { return canceled_; }
 
 private:
+    // TimerQueue links timers into the buckets of its timing wheel
+    friend class TimerQueue;
+
     TimerCallback callback_;
     Timestamp when_;
-    const Nanosecond interval_;
+    Nanosecond interval_;
     bool repeat_;
     bool canceled_;
+    bool rearmed_;  // reset while expired, insert again instead of running
+    int bucket_;    // -1 if not in timing wheel
+    uint32_t generation_; // bumped when recycled
+    Timer* prev_;
+    Timer* next_;   // also links the free list
+};
+
+// handle of a timer. a timer is recycled once it fires (one shot) or
+// is canceled, the handle is stale since then and cancelling it is a
+// no-op rather than a use after free
+class TimerId
+{
+public:
+    TimerId()
+            : timer_(nullptr),
+              generation_(0)
+    {}
+
+    explicit operator bool() const
+    { return timer_ != nullptr; }
+
+private:
+    friend class TimerQueue;
+
+    TimerId(Timer* timer, uint32_t generation)
+            : timer_(timer),
+              generation_(generation)
+    {}
+
+    Timer* timer_;
+    uint32_t generation_;
 };
 
 }
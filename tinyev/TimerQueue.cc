@@ -2,9 +2,12 @@
 // Created by frank on 17-11-17.
 //
 #include <sys/timerfd.h>
+#include <sys/prctl.h>
 #include <strings.h>
 #include <unistd.h>
 #include <ratio> // std::nano::den
+#include <algorithm>
+#include <memory>
 
 #include <tinyev/Logger.h>
 #include <tinyev/EventLoop.h>
@@ -31,104 +34,388 @@ void timerfdRead(int fd)
         ERROR("timerfdRead get %ld, not %lu", n, sizeof(val));
 }
 
-struct timespec durationFromNow(Timestamp when)
-{
-    struct timespec ret;
-    Nanosecond ns = when - clock::now();
-    if (ns < 1ms) ns = 1ms;
-
-    ret.tv_sec = static_cast<time_t>(ns.count() / std::nano::den);
-    ret.tv_nsec = ns.count() % std::nano::den;
-    return ret;
-}
-
 void timerfdSet(int fd, Timestamp when)
 {
-    struct itimerspec oldtime, newtime;
-    bzero(&oldtime, sizeof(itimerspec));
+    // Timestamp is CLOCK_MONOTONIC, arm at the absolute time
+    // without reading the clock, a past time expires at once
+    struct itimerspec newtime;
     bzero(&newtime, sizeof(itimerspec));
-    newtime.it_value = durationFromNow(when);
+    Nanosecond ns = std::max(when.time_since_epoch(), 1ns);
+    newtime.it_value.tv_sec = static_cast<time_t>(ns.count() / std::nano::den);
+    newtime.it_value.tv_nsec = ns.count() % std::nano::den;
 
-    int ret = timerfd_settime(fd, 0, &newtime, &oldtime);
+    int ret = timerfd_settime(fd, TFD_TIMER_ABSTIME, &newtime, nullptr);
     if (ret == -1)
         SYSERR("timerfd_settime()");
 }
 
 }
 
-TimerQueue::TimerQueue(EventLoop *loop)
+TimerQueue::TimerQueue(EventLoop *loop, Nanosecond tick)
         : loop_(loop),
           timerfd_(timerfdCreate()),
-          timerChannel_(loop, timerfd_)
+          expirations_(0),
+          timerChannel_(loop, timerfd_, this),
+          tick_(tick),
+          currentTick_(ticksFloor(clock::now())),
+          armedTick_(-1),
+          occupied_{0},
+          buckets_{},
+          free_(nullptr),
+          pollDriven_(false),
+          timerSlack_(0)
 {
+    assert(tick_ > Nanosecond::zero());
     loop_->assertInLoopThread();
-    timerChannel_.setReadCallback([this](){handleRead();});
+    if (loop_->completionIo())
+        timerChannel_.setIoMode(Channel::kCompletionIo);
     timerChannel_.enableRead();
 }
 
 TimerQueue::~TimerQueue()
 {
-    for (auto& p: timers_)
-        delete p.second;
+    for (int level = 0; level < kLevels; ++level) {
+        for (int slot = 0; slot < kSlots; ++slot) {
+            Timer* timer = takeBucket(level, slot);
+            while (timer != nullptr) {
+                Timer* next = timer->next_;
+                delete timer;
+                timer = next;
+            }
+        }
+    }
+    while (free_ != nullptr) {
+        Timer* next = free_->next_;
+        delete free_;
+        free_ = next;
+    }
+    timerChannel_.disableAll();
     ::close(timerfd_);
 }
 
 
-Timer* TimerQueue::addTimer(TimerCallback cb, Timestamp when, Nanosecond interval)
+TimerId TimerQueue::addTimer(TimerCallback cb, Timestamp when, Nanosecond interval)
 {
-    Timer* timer = new Timer(std::move(cb), when, interval);
-    loop_->runInLoop([=](){
-        auto ret = timers_.insert({when, timer});
-        assert(ret.second);
-
-        if (timers_.begin() == ret.first)
-            timerfdSet(timerfd_, when);
+    if (loop_->isInLoopThread()) {
+        Timer* timer = newTimer(std::move(cb), when, interval);
+        insert(timer);
+        rearm();
+        return TimerId(timer, timer->generation_);
+    }
+    // the free list is not thread safe, it takes the timer when done.
+    // the loop may fire and recycle it before queueInLoop() returns,
+    // and drops it with the task if it never runs
+    auto timer = std::make_unique<Timer>(std::move(cb), when, interval);
+    TimerId id(timer.get(), timer->generation_);
+    loop_->queueInLoop([this, timer = std::move(timer)]() mutable {
+        insert(timer.release());
+        rearm();
     });
+    return id;
+}
+
+void TimerQueue::cancelTimer(TimerId id)
+{
+    if (loop_->isInLoopThread())
+        cancelInLoop(id);
+    else
+        loop_->queueInLoop([=](){ cancelInLoop(id); });
+}
+
+bool TimerQueue::resetTimer(TimerId id, Timestamp when)
+{
+    loop_->assertInLoopThread();
+    if (!pending(id))
+        return false;
+    Timer* timer = id.timer_;
+    timer->when_ = when;
+    if (timer->bucket_ >= 0) {
+        unlink(timer);
+        insert(timer);
+        rearm();
+    }
+    // expired and waiting to run (or running)
+    else timer->rearmed_ = true;
+    return true;
+}
+
+Timer* TimerQueue::newTimer(TimerCallback cb, Timestamp when, Nanosecond interval)
+{
+    Timer* timer = free_;
+    if (timer == nullptr)
+        return new Timer(std::move(cb), when, interval);
+    free_ = timer->next_;
+    timer->next_ = nullptr;
+    timer->callback_ = std::move(cb);
+    timer->when_ = when;
+    timer->interval_ = interval;
+    timer->repeat_ = interval > Nanosecond::zero();
     return timer;
 }
 
-void TimerQueue::cancelTimer(Timer* timer)
+void TimerQueue::recycle(Timer* timer)
 {
-    loop_->runInLoop([timer, this](){
-        timer->cancel();
-        timers_.erase({timer->when(), timer});
-        delete timer;
-    });
+    assert(timer->bucket_ == -1);
+    // release what the callback holds now
+    timer->callback_ = nullptr;
+    timer->canceled_ = false;
+    timer->rearmed_ = false;
+    timer->generation_++;
+    timer->prev_ = nullptr;
+    timer->next_ = free_;
+    free_ = timer;
+}
+
+bool TimerQueue::pending(TimerId id) const
+{
+    return id.timer_ != nullptr &&
+           id.timer_->generation_ == id.generation_ &&
+           !id.timer_->canceled_;
+}
+
+void TimerQueue::cancelInLoop(TimerId id)
+{
+    if (!pending(id))
+        return;
+    Timer* timer = id.timer_;
+    if (timer->bucket_ >= 0) {
+        unlink(timer);
+        recycle(timer);
+    }
+    // expired and waiting to run (or running),
+    // expireTimers() will recycle it
+    else timer->cancel();
+}
+
+void TimerQueue::setTick(Nanosecond tick)
+{
+    loop_->assertInLoopThread();
+    assert(tick > Nanosecond::zero());
+    for (uint64_t bits: occupied_) {
+        assert(bits == 0); (void)bits;
+    }
+    tick_ = tick;
+    currentTick_ = ticksFloor(clock::now());
+    armedTick_ = -1;
+}
+
+void TimerQueue::setPollDriven(bool on)
+{
+    loop_->assertInLoopThread();
+    if (pollDriven_ == on)
+        return;
+    pollDriven_ = on;
+    if (on) {
+        timerChannel_.disableRead();
+        // disarming also clears a pending expiration
+        struct itimerspec newtime;
+        bzero(&newtime, sizeof(itimerspec));
+        if (timerfd_settime(timerfd_, 0, &newtime, nullptr) == -1)
+            SYSERR("timerfd_settime()");
+        armedTick_ = -1;
+        // poll() timeouts are extended by the timer slack (50us by
+        // default) while timerfd expirations are not, tighten it
+        timerSlack_ = ::prctl(PR_GET_TIMERSLACK, 0, 0, 0, 0);
+        if (::prctl(PR_SET_TIMERSLACK, 1, 0, 0, 0) == -1)
+            SYSERR("prctl(PR_SET_TIMERSLACK)");
+    }
+    else {
+        if (timerSlack_ > 0)
+            ::prctl(PR_SET_TIMERSLACK, timerSlack_, 0, 0, 0);
+        timerChannel_.enableRead();
+        rearm();
+    }
+}
+
+Nanosecond TimerQueue::timeout() const
+{
+    int64_t tick = nextEventTick();
+    if (tick == -1)
+        return -1ns;
+    return std::max(Timestamp(tick_ * tick) - clock::now(), Nanosecond::zero());
 }
 
 void TimerQueue::handleRead()
 {
     loop_->assertInLoopThread();
     timerfdRead(timerfd_);
+    armedTick_ = -1;
+    expireTimers();
+}
+
+struct iovec TimerQueue::readBuffer()
+{
+    return {&expirations_, sizeof(expirations_)};
+}
+
+void TimerQueue::handleReadDone(int result)
+{
+    loop_->assertInLoopThread();
+    if (result != sizeof(expirations_))
+        ERROR("TimerQueue::handleReadDone() get %d, not %lu", result, sizeof(expirations_));
+    armedTick_ = -1;
+    expireTimers();
+}
 
+void TimerQueue::expireTimers()
+{
+    loop_->assertInLoopThread();
     Timestamp now(clock::now());
-    for (auto& e: getExpired(now)) {
-        Timer* timer = e.second;
-        assert(timer->expired(now));
+    int64_t nowTick = ticksFloor(now);
+    int64_t tick = nextEventTick();
+    if (tick == -1 || tick > nowTick) {
+        rearm();
+        return;
+    }
+    expire(nowTick);
 
-        if (!timer->canceled())
+    std::vector<Timer*> expired;
+    expired.swap(expired_);
+    for (Timer* timer: expired) {
+        assert(timer->expired(now) || timer->rearmed_);
+        if (!timer->canceled() && !timer->rearmed_)
             timer->run();
-        if (!timer->canceled() && timer->repeat()) {
-            timer->restart();
-            e.first = timer->when();
-            timers_.insert(e);
+        if (!timer->canceled() && (timer->rearmed_ || timer->repeat())) {
+            if (!timer->rearmed_)
+                timer->restart();
+            timer->rearmed_ = false;
+            insert(timer);
         }
-        else delete timer;
+        else recycle(timer);
     }
+    expired.clear();
+    expired_.swap(expired);
 
-    if (!timers_.empty())
-        timerfdSet(timerfd_, timers_.begin()->first);
+    rearm();
 }
 
-std::vector<TimerQueue::Entry> TimerQueue::getExpired(Timestamp now)
+void TimerQueue::insert(Timer* timer)
 {
-    Entry en(now + 1ns, nullptr);
-    std::vector<Entry> entries;
+    assert(timer->bucket_ == -1);
+    // currentTick_ only moves in expire(), catch up after an idle
+    // period or a short timer would start high and cascade down
+    if (std::all_of(std::begin(occupied_), std::end(occupied_),
+                    [](uint64_t bits) { return bits == 0; }))
+        currentTick_ = std::max(currentTick_, ticksFloor(loop_->now()));
+    int64_t expire = std::max(ticksCeil(timer->when()), currentTick_);
+    auto delta = static_cast<uint64_t>(expire - currentTick_);
+
+    int level = 0;
+    while (level < kLevels - 1 && delta >> (kSlotBits * (level + 1)) != 0)
+        level++;
+    // too far away, park it in the farthest bucket,
+    // it will be inserted again when cascaded
+    const uint64_t range = 1ull << (kSlotBits * kLevels);
+    if (delta >= range)
+        expire = currentTick_ + static_cast<int64_t>(range - 1);
+
+    int slot = static_cast<int>((expire >> (kSlotBits * level)) & (kSlots - 1));
+    Timer*& head = buckets_[level][slot];
+    timer->bucket_ = level * kSlots + slot;
+    timer->prev_ = nullptr;
+    timer->next_ = head;
+    if (head != nullptr)
+        head->prev_ = timer;
+    head = timer;
+    occupied_[level] |= 1ull << slot;
+}
 
-    auto end = timers_.lower_bound(en);
-    entries.assign(timers_.begin(), end);
-    timers_.erase(timers_.begin(), end);
+void TimerQueue::unlink(Timer* timer)
+{
+    assert(timer->bucket_ >= 0);
+    int level = timer->bucket_ / kSlots;
+    int slot = timer->bucket_ % kSlots;
+    if (timer->prev_ != nullptr)
+        timer->prev_->next_ = timer->next_;
+    else
+        buckets_[level][slot] = timer->next_;
+    if (timer->next_ != nullptr)
+        timer->next_->prev_ = timer->prev_;
+    if (buckets_[level][slot] == nullptr)
+        occupied_[level] &= ~(1ull << slot);
+    timer->bucket_ = -1;
+    timer->prev_ = timer->next_ = nullptr;
+}
 
-    return entries;
+Timer* TimerQueue::takeBucket(int level, int slot)
+{
+    Timer* head = buckets_[level][slot];
+    buckets_[level][slot] = nullptr;
+    occupied_[level] &= ~(1ull << slot);
+    for (Timer* timer = head; timer != nullptr; timer = timer->next_)
+        timer->bucket_ = -1;
+    return head;
 }
 
+void TimerQueue::expire(int64_t nowTick)
+{
+    while (true) {
+        int64_t tick = nextEventTick();
+        if (tick == -1 || tick > nowTick)
+            break;
+        currentTick_ = tick;
+
+        // cascade from top to bottom, a timer may drop several levels
+        for (int level = kLevels - 1; level > 0; --level) {
+            int shift = kSlotBits * level;
+            if ((tick & ((int64_t(1) << shift) - 1)) != 0)
+                continue;
+            int slot = static_cast<int>((tick >> shift) & (kSlots - 1));
+            Timer* timer = takeBucket(level, slot);
+            while (timer != nullptr) {
+                Timer* next = timer->next_;
+                insert(timer);
+                timer = next;
+            }
+        }
+
+        int slot = static_cast<int>(tick & (kSlots - 1));
+        for (Timer* timer = takeBucket(0, slot); timer != nullptr; timer = timer->next_)
+            expired_.push_back(timer);
+    }
+    // nothing is scheduled in (currentTick_, nowTick]
+    currentTick_ = nowTick + 1;
+}
+
+int64_t TimerQueue::nextEventTick() const
+{
+    // a bucket of level n is processed at the first tick aligned to 64^n
+    // that maps to it, either expiring (n == 0) or cascading (n > 0)
+    int64_t result = -1;
+    for (int level = 0; level < kLevels; ++level) {
+        uint64_t bits = occupied_[level];
+        if (bits == 0)
+            continue;
+        int shift = kSlotBits * level;
+        int64_t first = (currentTick_ + (int64_t(1) << shift) - 1) >> shift;
+        auto rotation = static_cast<int>(first & (kSlots - 1));
+        if (rotation != 0)
+            bits = (bits >> rotation) | (bits << (kSlots - rotation));
+        int64_t tick = (first + __builtin_ctzll(bits)) << shift;
+        if (result == -1 || tick < result)
+            result = tick;
+    }
+    return result;
+}
+
+void TimerQueue::rearm()
+{
+    // only touch the timerfd when the earliest bucket changes
+    if (pollDriven_)
+        return;
+    int64_t tick = nextEventTick();
+    if (tick != -1 && (armedTick_ == -1 || tick < armedTick_)) {
+        armedTick_ = tick;
+        timerfdSet(timerfd_, Timestamp(tick_ * tick));
+    }
+}
+
+int64_t TimerQueue::ticksFloor(Timestamp when) const
+{
+    return when.time_since_epoch() / tick_;
+}
+
+int64_t TimerQueue::ticksCeil(Timestamp when) const
+{
+    return (when.time_since_epoch() + tick_ - 1ns) / tick_;
+}
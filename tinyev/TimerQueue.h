@@ -5,8 +5,8 @@
 #ifndef TINYEV_TIMERQUEUE_H
 #define TINYEV_TIMERQUEUE_H
 
-#include <memory>
-#include <set>
+#include <cstdint>
+#include <vector>
 
 #include <tinyev/Timer.h>
 #include <tinyev/Channel.h>
@@ -14,28 +14,81 @@
 namespace ev
 {
 
-class TimerQueue: noncopyable
+// hierarchical timing wheel driven by a timerfd, or by the timeout
+// of poll() in poll driven mode.
+//
+// level n has 64 buckets of 64^n ticks each, timers are moved to a
+// lower level when their bucket comes (cascade), so add, cancel and
+// expire are O(1). a timer never fires before its expiration, but
+// may fire up to one tick late.
+//
+// timers added in loop thread come from a free list and go back to it
+// when done, the list is never trimmed so a stale TimerId always points
+// to a Timer and its generation tells it is stale.
+class TimerQueue: noncopyable, private ChannelHandler
 {
 public:
     explicit
-    TimerQueue(EventLoop* loop);
+    TimerQueue(EventLoop* loop, Nanosecond tick = 1ms);
     ~TimerQueue();
 
-    Timer* addTimer(TimerCallback cb, Timestamp when, Nanosecond interval);
-    void cancelTimer(Timer* timer);
+    TimerId addTimer(TimerCallback cb, Timestamp when, Nanosecond interval);
+    void cancelTimer(TimerId id);
+    // must be called in loop thread
+    bool resetTimer(TimerId id, Timestamp when);
+
+    // must be called in loop thread with no timer pending
+    void setTick(Nanosecond tick);
+    Nanosecond tick() const
+    { return tick_; }
+
+    // leave the timerfd alone, the owner polls with timeout() and calls
+    // expireTimers() after poll() returns. must be called in loop thread
+    void setPollDriven(bool on);
+    bool pollDriven() const
+    { return pollDriven_; }
+    // until the next tick to process, negative if no timer is pending
+    Nanosecond timeout() const;
+    void expireTimers();
 
 private:
-    typedef std::pair<Timestamp, Timer*> Entry;
-    typedef std::set<Entry> TimerList;
+    static const int kLevels = 6;
+    static const int kSlotBits = 6;
+    static const int kSlots = 1 << kSlotBits;
+
+    void handleRead() override;
+    struct iovec readBuffer() override;
+    void handleReadDone(int result) override;
+
+    Timer* newTimer(TimerCallback cb, Timestamp when, Nanosecond interval);
+    void recycle(Timer* timer);
+    bool pending(TimerId id) const;
+    void cancelInLoop(TimerId id);
+
+    void insert(Timer* timer);
+    void unlink(Timer* timer);
+    Timer* takeBucket(int level, int slot);
+    void expire(int64_t nowTick);
+    int64_t nextEventTick() const;
+    void rearm();
 
-    void handleRead();
-    std::vector<Entry> getExpired(Timestamp now);
+    int64_t ticksFloor(Timestamp when) const;
+    int64_t ticksCeil(Timestamp when) const;
 
 private:
     EventLoop* loop_;
     const int timerfd_;
+    uint64_t expirations_; // read by the poller in completion IO
     Channel timerChannel_;
-    TimerList timers_;
+    Nanosecond tick_;
+    int64_t currentTick_; // ticks before it are processed
+    int64_t armedTick_;   // -1 if timerfd is not armed
+    uint64_t occupied_[kLevels]; // bitmap of non-empty buckets
+    Timer* buckets_[kLevels][kSlots];
+    std::vector<Timer*> expired_;
+    Timer* free_;
+    bool pollDriven_;
+    int timerSlack_; // of loop thread before poll driven
 };
 
 }
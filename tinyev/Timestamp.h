@@ -11,7 +11,7 @@
 namespace ev
 {
 
-using std::chrono::system_clock;
+using std::chrono::steady_clock;
 using namespace std::literals::chrono_literals;
 
 
@@ -22,13 +22,15 @@ typedef std::chrono::seconds       Second;
 typedef std::chrono::minutes       Minute;
 typedef std::chrono::hours         Hour;
 typedef std::chrono::time_point
-        <system_clock, Nanosecond> Timestamp;
+        <steady_clock, Nanosecond> Timestamp;
 
+// monotonic, the clock of timerfd, not moved by a wall clock step.
+// in loop thread EventLoop::now() is cheaper
 namespace clock
 {
 
 inline Timestamp now()
-{ return system_clock::now(); }
+{ return steady_clock::now(); }
 
 inline Timestamp nowAfter(Nanosecond interval)
 { return now() + interval; }